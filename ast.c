@@ -3,18 +3,22 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ast.h"
 #include "errors.h"
 #include "memory.h"
+#include "parser.h"
 #include "pointer_list.h"
+#include "thread_pool.h"
 // #include "scanner.h"
 
 #define PRE_STATE                                                  \
     do {                                                           \
         if(state != NULL) {                                        \
             if(((ast_state_t*)(state))->pre != NULL)               \
-                (*((ast_state_t*)(state))->pre)((ast_node_t*)ptr); \
+                (*((ast_state_t*)(state))->pre)((ast_node_t*)ptr,  \
+                        ((ast_state_t*)(state))->state);           \
         }                                                          \
     } while(0)
 
@@ -22,7 +26,8 @@
     do {                                                            \
         if(state != NULL) {                                         \
             if(((ast_state_t*)(state))->post != NULL)               \
-                (*((ast_state_t*)(state))->post)((ast_node_t*)ptr); \
+                (*((ast_state_t*)(state))->post)((ast_node_t*)ptr,  \
+                        ((ast_state_t*)(state))->state);            \
         }                                                           \
     } while(0)
 
@@ -86,7 +91,10 @@ static int num_states = 0;
 
 #define START
 
-#define FINISH RETURN
+#define FINISH    \
+    do {          \
+        return;   \
+    } while(false)
 
 #endif
 
@@ -157,8 +165,9 @@ static void traverse_non_terminal_rule(ast_non_terminal_rule_t* ptr, ast_state_t
 
     int post = 0;
     ast_rule_element_t* elem;
+    pointer_list_t* rule_elems = get_rule_elems(ptr);
 
-    while(NULL != (elem = iterate_pointer_list(ptr->rule_elems, &post)))
+    while(NULL != (elem = iterate_pointer_list(rule_elems, &post)))
         traverse_rule_element(elem, state);
 
     RETURN;
@@ -318,11 +327,134 @@ void traverse_ast(void* ptr, void* state) {
     FINISH;
 }
 
+/*
+ * Traverse the tree below any node.
+ */
+void traverse_ast_node(void* ptr, void* state) {
+
+    assert(ptr != NULL);
+
+    switch(get_ast_node_type(ptr)) {
+        case AST_GRAMMAR:
+            traverse_grammar((ast_grammar_t*)ptr, (ast_state_t*)state);
+            break;
+        case AST_NON_TERMINAL_RULE:
+            traverse_non_terminal_rule((ast_non_terminal_rule_t*)ptr, (ast_state_t*)state);
+            break;
+        case AST_TERMINAL_RULE:
+            traverse_terminal_rule((ast_terminal_rule_t*)ptr, (ast_state_t*)state);
+            break;
+        case AST_RULE_ELEMENT:
+            traverse_rule_element((ast_rule_element_t*)ptr, (ast_state_t*)state);
+            break;
+        case AST_ONE_OR_MORE_FUNC:
+            traverse_one_or_more_func((ast_one_or_more_func_t*)ptr, (ast_state_t*)state);
+            break;
+        case AST_ZERO_OR_ONE_FUNC:
+            traverse_zero_or_one_func((ast_zero_or_one_func_t*)ptr, (ast_state_t*)state);
+            break;
+        case AST_ZERO_OR_MORE_FUNC:
+            traverse_zero_or_more_func((ast_zero_or_more_func_t*)ptr, (ast_state_t*)state);
+            break;
+        case AST_OR_FUNC:
+            traverse_or_func((ast_or_func_t*)ptr, (ast_state_t*)state);
+            break;
+        case AST_GROUP_FUNC:
+            traverse_group_func((ast_group_func_t*)ptr, (ast_state_t*)state);
+            break;
+        default:
+            fatal_error("unknown node type in %s: %d", __func__, get_ast_node_type(ptr));
+    }
+}
+
+typedef struct {
+    ast_node_t* rule;
+    ast_state_t state;
+} subtree_task_t;
+
+static void traverse_subtree(subtree_task_t* task) {
+
+    traverse_ast_node(task->rule, &task->state);
+}
+
+/*
+ * The rules in the grammar are independent of each other so they are given
+ * to the thread pool. The grammar node itself is visited by the calling
+ * thread with the shared state.
+ */
+void traverse_ast_parallel(void* node, ast_parallel_state_t* state, int num_threads) {
+
+    assert(node != NULL);
+    assert(state != NULL);
+
+    ast_grammar_t* ptr = (ast_grammar_t*)node;
+    ast_state_t shared = { state->pre, state->post, state->state };
+
+    int len = len_pointer_list(ptr->rules);
+    subtree_task_t* tasks = _ALLOC_ARRAY(subtree_task_t, len);
+
+    if(shared.pre != NULL)
+        (*shared.pre)(ptr, shared.state);
+
+    thread_pool_t* pool = create_thread_pool(num_threads);
+
+    for(int i = 0; i < len; i++) {
+        tasks[i].rule = index_pointer_list(ptr->rules, i);
+        // lazy bodies use the scanner, so they are parsed here and not by
+        // the workers
+        if(tasks[i].rule->type == AST_NON_TERMINAL_RULE)
+            get_rule_elems((ast_non_terminal_rule_t*)tasks[i].rule);
+        tasks[i].state.pre = state->pre;
+        tasks[i].state.post = state->post;
+        tasks[i].state.state = (state->create != NULL) ? (*state->create)(state->state) : state->state;
+        add_thread_pool_task(pool, (thread_task_t)traverse_subtree, &tasks[i]);
+    }
+
+    wait_thread_pool(pool);
+    destroy_thread_pool(pool);
+
+    if(state->merge != NULL) {
+        for(int i = 0; i < len; i++)
+            (*state->merge)(state->state, tasks[i].state.state);
+    }
+
+    if(shared.post != NULL)
+        (*shared.post)(ptr, shared.state);
+
+    _FREE(tasks);
+}
+
 ast_type_t get_ast_node_type(void* node) {
 
     return ((ast_node_t*)node)->type;
 }
 
+const char* ast_type_to_str(ast_type_t type) {
+
+    return (type == AST_GRAMMAR)               ? "grammar" :
+            (type == AST_NON_TERMINAL_RULE)    ? "non_terminal_rule" :
+            (type == AST_TERMINAL_RULE)        ? "terminal_rule" :
+            (type == AST_RULE_ELEMENT)         ? "rule_element" :
+            (type == AST_ONE_OR_MORE_FUNC)     ? "one_or_more_func" :
+            (type == AST_ZERO_OR_ONE_FUNC)     ? "zero_or_one_func" :
+            (type == AST_ZERO_OR_MORE_FUNC)    ? "zero_or_more_func" :
+            (type == AST_OR_FUNC)              ? "or_func" :
+            (type == AST_GROUP_FUNC)           ? "group_func" :
+                                                 "UNKNOWN";
+}
+
+/*
+ * The rule elements of a rule. If the body of the rule was skipped by a lazy
+ * parse, then it is parsed now.
+ */
+pointer_list_t* get_rule_elems(ast_non_terminal_rule_t* ptr) {
+
+    if(ptr->body != 0)
+        load_rule_body(ptr);
+
+    return ptr->rule_elems;
+}
+
 ast_node_t* create_ast_node(ast_type_t type) {
 
     ast_node_t* ptr = _ALLOC(get_ast_node_size(type));
@@ -330,3 +462,304 @@ ast_node_t* create_ast_node(ast_type_t type) {
 
     return ptr;
 }
+
+/*
+ * Hash consing. When sharing is turned on, nodes that are structurally the
+ * same as a node that was already built are replaced by the one that already
+ * exists. Nodes are built from the bottom up, so the children of a node have
+ * already been shared and can be compared by their address. Terminals are
+ * compared by type and text, so a shared node keeps a copy of the token of
+ * the first occurrence. Only the rule elements and the functions are shared.
+ * The rules and the grammar are unique. Every thread has its own table.
+ */
+static _Thread_local bool sharing = false;
+static _Thread_local ast_node_t** shared = NULL;
+static _Thread_local size_t shared_cap = 0;
+static _Thread_local size_t shared_len = 0;
+static _Thread_local size_t saved_nodes = 0;
+static _Thread_local size_t saved_bytes = 0;
+
+static size_t hash_mix(size_t hash, size_t val) {
+
+    hash ^= val;
+    hash *= (size_t)0x100000001b3ULL;
+    return hash;
+}
+
+static size_t hash_string(size_t hash, const char* str) {
+
+    while(*str != '\0')
+        hash = hash_mix(hash, (unsigned char)*str++);
+
+    return hash;
+}
+
+static size_t hash_ast_node(ast_node_t* node) {
+
+    size_t hash = hash_mix((size_t)0xcbf29ce484222325ULL, node->type);
+
+    switch(node->type) {
+        case AST_RULE_ELEMENT: {
+            ast_rule_element_t* ptr = (ast_rule_element_t*)node;
+            if(ptr->term != NULL) {
+                hash = hash_mix(hash, ptr->term->type);
+                hash = hash_string(hash, ptr->term->text);
+            }
+            else
+                hash = hash_mix(hash, (size_t)ptr->nterm);
+        } break;
+        case AST_ONE_OR_MORE_FUNC:
+        case AST_ZERO_OR_ONE_FUNC:
+        case AST_ZERO_OR_MORE_FUNC:
+        case AST_OR_FUNC:
+            // these all have the same layout
+            hash = hash_mix(hash, (size_t)((ast_or_func_t*)node)->elem);
+            break;
+        case AST_GROUP_FUNC: {
+            ast_group_func_t* ptr = (ast_group_func_t*)node;
+            for(int i = 0; i < len_pointer_list(ptr->list); i++)
+                hash = hash_mix(hash, (size_t)index_pointer_list(ptr->list, i));
+        } break;
+        default:
+            fatal_error("cannot share node type %d in %s", node->type, __func__);
+    }
+
+    return hash;
+}
+
+static bool compare_ast_node(ast_node_t* left, ast_node_t* right) {
+
+    if(left->type != right->type)
+        return false;
+
+    switch(left->type) {
+        case AST_RULE_ELEMENT: {
+            ast_rule_element_t* l = (ast_rule_element_t*)left;
+            ast_rule_element_t* r = (ast_rule_element_t*)right;
+            if(l->term != NULL && r->term != NULL)
+                return l->term->type == r->term->type && !strcmp(l->term->text, r->term->text);
+            return l->term == NULL && r->term == NULL && l->nterm == r->nterm;
+        }
+        case AST_ONE_OR_MORE_FUNC:
+        case AST_ZERO_OR_ONE_FUNC:
+        case AST_ZERO_OR_MORE_FUNC:
+        case AST_OR_FUNC:
+            return ((ast_or_func_t*)left)->elem == ((ast_or_func_t*)right)->elem;
+        case AST_GROUP_FUNC: {
+            pointer_list_t* l = ((ast_group_func_t*)left)->list;
+            pointer_list_t* r = ((ast_group_func_t*)right)->list;
+            if(len_pointer_list(l) != len_pointer_list(r))
+                return false;
+            for(int i = 0; i < len_pointer_list(l); i++) {
+                if(index_pointer_list(l, i) != index_pointer_list(r, i))
+                    return false;
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static void insert_shared(ast_node_t* node, size_t hash) {
+
+    size_t idx = hash & (shared_cap - 1);
+
+    while(shared[idx] != NULL)
+        idx = (idx + 1) & (shared_cap - 1);
+
+    shared[idx] = node;
+}
+
+static void grow_shared(void) {
+
+    ast_node_t** old = shared;
+    size_t old_cap = shared_cap;
+
+    shared_cap = (shared_cap == 0) ? 1 << 8 : shared_cap << 1;
+    shared = _ALLOC_ARRAY(ast_node_t*, shared_cap);
+
+    for(size_t i = 0; i < old_cap; i++) {
+        if(old[i] != NULL)
+            insert_shared(old[i], hash_ast_node(old[i]));
+    }
+
+    _FREE(old);
+}
+
+/*
+ * The children of a shared node are shared too, so every node in the table
+ * is freed on its own.
+ */
+static void free_shared_node(ast_node_t* node) {
+
+    switch(node->type) {
+        case AST_RULE_ELEMENT: {
+            token_t* tok = ((ast_rule_element_t*)node)->term;
+            if(tok != NULL) {
+                _FREE(tok->text);
+                _FREE(tok->name);
+                _FREE(tok);
+            }
+        } break;
+        case AST_GROUP_FUNC:
+            destroy_pointer_list(((ast_group_func_t*)node)->list);
+            break;
+        default:
+            break;
+    }
+
+    _FREE(node);
+}
+
+/*
+ * Turn hash consing on or off. Turning it off frees the nodes that were
+ * shared and their tokens, but not the statistics. The trees that use them
+ * have to be destroyed before that, while sharing is still on.
+ */
+void set_ast_sharing(bool flag) {
+
+    sharing = flag;
+
+    if(!sharing) {
+        for(size_t i = 0; i < shared_cap; i++) {
+            if(shared[i] != NULL)
+                free_shared_node(shared[i]);
+        }
+        _FREE(shared);
+        shared = NULL;
+        shared_cap = 0;
+        shared_len = 0;
+    }
+}
+
+bool get_ast_sharing(void) {
+
+    return sharing;
+}
+
+/*
+ * Return the node that is the same as this one. If there is one, then this
+ * node is freed. Otherwise, this node is remembered and returned.
+ */
+ast_node_t* share_ast_node(ast_node_t* node) {
+
+    if(!sharing || node == NULL)
+        return node;
+
+    if(node->type == AST_GRAMMAR || node->type == AST_NON_TERMINAL_RULE || node->type == AST_TERMINAL_RULE)
+        return node;
+
+    if((shared_len + 1) * 2 > shared_cap)
+        grow_shared();
+
+    size_t hash = hash_ast_node(node);
+    size_t idx = hash & (shared_cap - 1);
+
+    while(shared[idx] != NULL) {
+        if(compare_ast_node(shared[idx], node)) {
+            saved_nodes++;
+            saved_bytes += get_ast_node_size(node->type);
+            if(node->type == AST_GROUP_FUNC) {
+                pointer_list_t* list = ((ast_group_func_t*)node)->list;
+                saved_bytes += sizeof(pointer_list_t);
+                if(list->list != list->local)
+                    saved_bytes += list->cap * sizeof(void*);
+                destroy_pointer_list(list);
+            }
+            _FREE(node);
+            return shared[idx];
+        }
+        idx = (idx + 1) & (shared_cap - 1);
+    }
+
+    // The table outlives the tokens when they are released as the parse
+    // goes, so it keeps its own copy of the token.
+    if(node->type == AST_RULE_ELEMENT && ((ast_rule_element_t*)node)->term != NULL) {
+        ast_rule_element_t* ptr = (ast_rule_element_t*)node;
+        token_t* tok = _COPY_DS(ptr->term, token_t);
+        tok->text = _COPY_STRING(ptr->term->text);
+        if(ptr->term->name != NULL)
+            tok->name = _COPY_STRING(ptr->term->name);
+        ptr->term = tok;
+    }
+
+    shared[idx] = node;
+    shared_len++;
+
+    return node;
+}
+
+/*
+ * The number of nodes that were replaced by a shared node and the number of
+ * bytes that were freed by doing it.
+ */
+void get_ast_sharing_stats(size_t* nodes, size_t* bytes) {
+
+    if(nodes != NULL)
+        *nodes = saved_nodes;
+    if(bytes != NULL)
+        *bytes = saved_bytes;
+}
+
+static void destroy_node_list(pointer_list_t* list) {
+
+    int post = 0;
+    void* node;
+
+    // the body of a lazy rule that was never parsed
+    if(list == NULL)
+        return;
+
+    while(NULL != (node = iterate_pointer_list(list, &post)))
+        destroy_ast(node);
+
+    destroy_pointer_list(list);
+}
+
+/*
+ * Free a node and everything below it. The tokens belong to the scanner and
+ * are not freed. When sharing is turned on, the rule elements and the
+ * functions belong to the sharing table and are not freed either.
+ */
+void destroy_ast(void* ptr) {
+
+    if(ptr == NULL)
+        return;
+
+    ast_node_t* node = (ast_node_t*)ptr;
+
+    switch(node->type) {
+        case AST_GRAMMAR:
+            destroy_node_list(((ast_grammar_t*)node)->rules);
+            break;
+        case AST_NON_TERMINAL_RULE:
+            destroy_node_list(((ast_non_terminal_rule_t*)node)->rule_elems);
+            break;
+        case AST_TERMINAL_RULE:
+            break;
+        case AST_RULE_ELEMENT:
+            if(sharing)
+                return;
+            destroy_ast(((ast_rule_element_t*)node)->nterm);
+            break;
+        case AST_ONE_OR_MORE_FUNC:
+        case AST_ZERO_OR_ONE_FUNC:
+        case AST_ZERO_OR_MORE_FUNC:
+        case AST_OR_FUNC:
+            if(sharing)
+                return;
+            // these all have the same layout
+            destroy_ast(((ast_or_func_t*)node)->elem);
+            break;
+        case AST_GROUP_FUNC:
+            if(sharing)
+                return;
+            destroy_node_list(((ast_group_func_t*)node)->list);
+            break;
+        default:
+            fatal_error("unknown node type in %s: %d", __func__, node->type);
+    }
+
+    _FREE(node);
+}
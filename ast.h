@@ -1,6 +1,9 @@
 #ifndef _AST_H_
 #define _AST_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "pointer_list.h"
 #include "scanner.h"
 
@@ -16,7 +19,11 @@ typedef enum {
     AST_GROUP_FUNC,
 } ast_type_t;
 
-typedef void (*ast_callback_t)(void*);
+/*
+ * Callbacks receive the node and the state pointer that was registered with
+ * them in the ast_state_t.
+ */
+typedef void (*ast_callback_t)(void* node, void* state);
 
 typedef struct _ast_node_t_ {
     ast_type_t type;
@@ -28,6 +35,20 @@ typedef struct _ast_state_t_ {
     void* state;
 } ast_state_t;
 
+/*
+ * State for a parallel traversal. Every top level rule is traversed with its
+ * own state that is made by create() from the shared state. When all of the
+ * rules have been traversed, merge() is called with each of the local states
+ * in the order that the rules appear in the grammar.
+ */
+typedef struct _ast_parallel_state_t_ {
+    ast_callback_t pre;
+    ast_callback_t post;
+    void* (*create)(void* state);
+    void (*merge)(void* state, void* local);
+    void* state;
+} ast_parallel_state_t;
+
 
 /*
  * grammar {
@@ -55,14 +76,23 @@ typedef struct _ast_terminal_rule_t_ {
 
 /*
  * non_terminal_rule {
- *     NON_TERMINAL '{' +rule_element '}'
+ *     ?'~' NON_TERMINAL rule_body
+ * }
+ *
+ * rule_body {
+ *     '{' +rule_element '}'
  * }
  *
+ * Lazy is set for a rule that is marked with '~'. When the body was skipped
+ * by a lazy parse, body is the position of its '{' token and the rule
+ * elements are NULL until get_rule_elems() is called.
  */
 typedef struct _ast_non_terminal_rule_t_ {
     ast_node_t node;
     token_t* nterm;
     pointer_list_t* rule_elems;
+    bool lazy;
+    size_t body;
 } ast_non_terminal_rule_t;
 
 /*
@@ -143,7 +173,16 @@ typedef struct _ast_group_func_t {
 } ast_group_func_t;
 
 void traverse_ast(void* node, void* state);
+void traverse_ast_node(void* node, void* state);
+void traverse_ast_parallel(void* node, ast_parallel_state_t* state, int num_threads);
 ast_node_t* create_ast_node(ast_type_t type);
+void destroy_ast(void* node);
+void set_ast_sharing(bool flag);
+bool get_ast_sharing(void);
+ast_node_t* share_ast_node(ast_node_t* node);
+void get_ast_sharing_stats(size_t* nodes, size_t* bytes);
 ast_type_t get_ast_node_type(void* node);
+const char* ast_type_to_str(ast_type_t type);
+pointer_list_t* get_rule_elems(ast_non_terminal_rule_t* ptr);
 
 #endif /* _AST_H_ */
@@ -0,0 +1,271 @@
+/*
+ * The pass manager runs AST passes. Every pass is placed at a level that is
+ * one more than the highest level of the passes that it depends on. All of
+ * the passes on a level are run in a single walk of the tree, so the number
+ * of walks is the length of the longest dependency chain rather than the
+ * number of passes. A walk where every pass can run in parallel is given to
+ * traverse_ast_parallel() when the manager is parallel.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ast.h"
+#include "ast_pass.h"
+#include "errors.h"
+#include "memory.h"
+#include "pointer_list.h"
+
+#define LEVEL_UNKNOWN (-1)
+#define LEVEL_VISITING (-2)
+
+/*
+ * Call the pre visitor of every pass on the level in the order they were
+ * registered.
+ */
+static void fused_pre(ast_node_t* node, pointer_list_t* passes) {
+
+    int post = 0;
+    ast_pass_t* pass;
+
+    while(NULL != (pass = iterate_pointer_list(passes, &post))) {
+        if(pass->pre != NULL)
+            (*pass->pre)(node, pass->state);
+    }
+}
+
+/*
+ * Call the post visitor of every pass on the level in the order they were
+ * registered.
+ */
+static void fused_post(ast_node_t* node, pointer_list_t* passes) {
+
+    int post = 0;
+    ast_pass_t* pass;
+
+    while(NULL != (pass = iterate_pointer_list(passes, &post))) {
+        if(pass->post != NULL)
+            (*pass->post)(node, pass->state);
+    }
+}
+
+/*
+ * The passes that one top level rule is visited with. Every pass is copied
+ * with a local state of its own.
+ */
+static void* fused_create(pointer_list_t* passes) {
+
+    int post = 0;
+    ast_pass_t* pass;
+    pointer_list_t* local = create_pointer_list();
+
+    while(NULL != (pass = iterate_pointer_list(passes, &post))) {
+        ast_pass_t* copy = _COPY_DS(pass, ast_pass_t);
+        copy->state = (*pass->create)(pass->state);
+        add_pointer_list(local, copy);
+    }
+
+    return local;
+}
+
+/*
+ * Merge the local state of every pass into its own state and free the
+ * copies. This is called in the order of the rules.
+ */
+static void fused_merge(pointer_list_t* passes, pointer_list_t* local) {
+
+    for(int i = 0; i < len_pointer_list(passes); i++) {
+        ast_pass_t* pass = index_pointer_list(passes, i);
+        ast_pass_t* copy = index_pointer_list(local, i);
+        (*pass->merge)(pass->state, copy->state);
+        _FREE(copy);
+    }
+
+    destroy_pointer_list(local);
+}
+
+/*
+ * The walk can be parallel if every pass on it can and the tree has top
+ * level rules to give to the threads. The copies of the passes are made on
+ * this thread but used on the others, so an allocator must not be
+ * installed.
+ */
+static bool can_run_parallel(ast_pass_manager_t* mgr, pointer_list_t* passes, ast_node_t* ast) {
+
+    int post = 0;
+    ast_pass_t* pass;
+
+    if(!mgr->parallel || ast->type != AST_GRAMMAR || get_allocator() != NULL)
+        return false;
+
+    while(NULL != (pass = iterate_pointer_list(passes, &post))) {
+        if(pass->create == NULL || pass->merge == NULL)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Find the level of a pass from its dependencies. A pass that is found while
+ * it is being visited is part of a dependency cycle.
+ */
+static int find_level(ast_pass_t* pass) {
+
+    if(pass->level == LEVEL_VISITING)
+        fatal_error("pass \"%s\" is part of a dependency cycle", pass->name);
+    else if(pass->level != LEVEL_UNKNOWN)
+        return pass->level;
+
+    pass->level = LEVEL_VISITING;
+
+    int level = 0;
+    int post = 0;
+    ast_pass_t* dep;
+
+    while(NULL != (dep = iterate_pointer_list(pass->deps, &post))) {
+        int lvl = find_level(dep) + 1;
+        if(lvl > level)
+            level = lvl;
+    }
+
+    pass->level = level;
+    return level;
+}
+
+ast_pass_manager_t* create_pass_manager(void) {
+
+    ast_pass_manager_t* ptr = _ALLOC_DS(ast_pass_manager_t);
+    ptr->passes = create_pointer_list();
+    ptr->parallel = false;
+    ptr->threads = 0;
+
+    return ptr;
+}
+
+void destroy_pass_manager(ast_pass_manager_t* mgr) {
+
+    if(mgr != NULL) {
+        int post = 0;
+        ast_pass_t* pass;
+
+        while(NULL != (pass = iterate_pointer_list(mgr->passes, &post))) {
+            destroy_pointer_list(pass->deps);
+            _FREE(pass);
+        }
+
+        destroy_pointer_list(mgr->passes);
+        _FREE(mgr);
+    }
+}
+
+ast_pass_t* add_pass(ast_pass_manager_t* mgr,
+                     const char* name,
+                     ast_callback_t pre,
+                     ast_callback_t post,
+                     void* state) {
+
+    assert(mgr != NULL);
+
+    ast_pass_t* ptr = _ALLOC_DS(ast_pass_t);
+    ptr->name = name;
+    ptr->pre = pre;
+    ptr->post = post;
+    ptr->create = NULL;
+    ptr->merge = NULL;
+    ptr->state = state;
+    ptr->deps = create_pointer_list();
+    ptr->level = LEVEL_UNKNOWN;
+
+    add_pointer_list(mgr->passes, ptr);
+
+    return ptr;
+}
+
+void add_pass_dependency(ast_pass_t* pass, ast_pass_t* dep) {
+
+    assert(pass != NULL);
+    assert(dep != NULL);
+
+    add_pointer_list(pass->deps, dep);
+}
+
+/*
+ * Let the pass visit the top level rules in parallel. Create() makes a local
+ * state for a rule from the state of the pass and merge() adds it back.
+ */
+void set_pass_parallel(ast_pass_t* pass,
+                       void* (*create)(void* state),
+                       void (*merge)(void* state, void* local)) {
+
+    assert(pass != NULL);
+
+    pass->create = create;
+    pass->merge = merge;
+}
+
+void set_pass_threads(ast_pass_manager_t* mgr, int num_threads) {
+
+    assert(mgr != NULL);
+
+    mgr->parallel = true;
+    mgr->threads = num_threads;
+}
+
+/*
+ * Run all of the passes over the AST. Returns the number of times that the
+ * tree was walked.
+ */
+int run_passes(ast_pass_manager_t* mgr, void* ast) {
+
+    assert(mgr != NULL);
+    assert(ast != NULL);
+
+    int post = 0;
+    int levels = 0;
+    ast_pass_t* pass;
+
+    while(NULL != (pass = iterate_pointer_list(mgr->passes, &post)))
+        pass->level = LEVEL_UNKNOWN;
+
+    post = 0;
+    while(NULL != (pass = iterate_pointer_list(mgr->passes, &post))) {
+        int lvl = find_level(pass) + 1;
+        if(lvl > levels)
+            levels = lvl;
+    }
+
+    ast_state_t state;
+    state.pre = (ast_callback_t)fused_pre;
+    state.post = (ast_callback_t)fused_post;
+
+    ast_parallel_state_t pstate;
+    pstate.pre = (ast_callback_t)fused_pre;
+    pstate.post = (ast_callback_t)fused_post;
+    pstate.create = (void* (*)(void*))fused_create;
+    pstate.merge = (void (*)(void*, void*))fused_merge;
+
+    for(int level = 0; level < levels; level++) {
+        pointer_list_t* fused = create_pointer_list();
+
+        post = 0;
+        while(NULL != (pass = iterate_pointer_list(mgr->passes, &post))) {
+            if(pass->level == level)
+                add_pointer_list(fused, pass);
+        }
+
+        if(can_run_parallel(mgr, fused, ast)) {
+            pstate.state = fused;
+            traverse_ast_parallel(ast, &pstate, mgr->threads);
+        }
+        else {
+            state.state = fused;
+            traverse_ast(ast, &state);
+        }
+
+        destroy_pointer_list(fused);
+    }
+
+    return levels;
+}
@@ -0,0 +1,51 @@
+#ifndef _AST_PASS_H_
+#define _AST_PASS_H_
+
+#include <stdbool.h>
+
+#include "ast.h"
+#include "pointer_list.h"
+
+/*
+ * A pass is a pair of visitors that are called before and after every node
+ * in the AST. Passes declare the passes that they depend on. Passes that do
+ * not depend on each other are fused into a single walk of the tree. A pass
+ * that has create() and merge() can visit the top level rules in parallel,
+ * see ast_parallel_state_t.
+ */
+typedef struct _ast_pass_t_ {
+    const char* name;
+    ast_callback_t pre;
+    ast_callback_t post;
+    void* (*create)(void* state);
+    void (*merge)(void* state, void* local);
+    void* state;
+    pointer_list_t* deps;
+    int level;
+} ast_pass_t;
+
+/*
+ * When parallel is set, a walk where every pass can run in parallel is done
+ * on threads threads, or one per CPU if that is less than one.
+ */
+typedef struct _ast_pass_manager_t_ {
+    pointer_list_t* passes;
+    bool parallel;
+    int threads;
+} ast_pass_manager_t;
+
+ast_pass_manager_t* create_pass_manager(void);
+void destroy_pass_manager(ast_pass_manager_t* mgr);
+ast_pass_t* add_pass(ast_pass_manager_t* mgr,
+                     const char* name,
+                     ast_callback_t pre,
+                     ast_callback_t post,
+                     void* state);
+void add_pass_dependency(ast_pass_t* pass, ast_pass_t* dep);
+void set_pass_parallel(ast_pass_t* pass,
+                       void* (*create)(void* state),
+                       void (*merge)(void* state, void* local));
+void set_pass_threads(ast_pass_manager_t* mgr, int num_threads);
+int run_passes(ast_pass_manager_t* mgr, void* ast);
+
+#endif /* _AST_PASS_H_ */
@@ -8,11 +8,625 @@
  * Generate the rule list. A list of data structures.
  *      Each rule has an item list. This allows the data structures to be
  *          correctly generated.
+ *
+ * The rules only read the AST and the symbol table once the lists are built,
+ * so every non-terminal is rendered and written by a thread pool task into
+ * its own buffer. The header is written last, after all of the rules.
+ *
+ * The files that were written are recorded in a manifest in the directory.
+ * A rule file only depends on its own rule, so it is not rendered again if
+ * the rule has not changed since the last time, and a file is not written if
+ * its content is the same as what is there. Files that are not touched keep
+ * their times, so make only rebuilds what changed.
  */
+#define _POSIX_C_SOURCE 200809L
 
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "ast.h"
+#include "ast_pass.h"
+#include "emit.h"
+#include "emit_pass1.h"
+#include "emit_pass2.h"
 #include "errors.h"
 #include "memory.h"
+#include "out_buffer.h"
 #include "regurge.h"
+#include "thread_pool.h"
+
+// #define TRACE_EMIT
+
+// Change this when the output changes for the same input, so that the
+// files from an older version are not taken to be current.
+#define EMIT_VERSION "5"
+
+#define MANIFEST_NAME "parsgen.sum"
+
+// the runtime of a parser that is not amalgamated
+#define RUNTIME_NAME "parser_rt.c"
+#define RUNTIME_RULE "parser_rt"
+
+/*
+ * A line of the manifest. Key is the hash of what the file was made from and
+ * hash is the hash of what is in it. The size and the time are what the file
+ * had after it was written, so a file that was changed since then is made
+ * again.
+ */
+typedef struct {
+    char* name;
+    size_t key;
+    size_t hash;
+    size_t size;
+    long long sec;
+    long nsec;
+    bool used;
+} emit_sum_t;
+
+typedef struct {
+    emit_sum_t** table;
+    size_t cap;
+    size_t len;
+} emit_manifest_t;
+
+/*
+ * When the parser is amalgamated, the task keeps the head and the body of
+ * the rule for the C file of the parser.
+ */
+typedef struct {
+    ast_non_terminal_rule_t* rule;
+    symbol_table_t* tab;
+    emit_manifest_t* manifest;
+    emit_options_t* opts;
+    const char* grammar;
+    const char* dir;
+    out_buffer_t* bufs[2];
+    emit_sum_t sum;
+    bool rendered;
+    bool written;
+    int status;
+} emit_task_t;
+
+static size_t hash_bytes(size_t hash, const char* str, size_t len) {
+
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= (size_t)0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static size_t hash_string(size_t hash, const char* str) {
+
+    // the terminator separates the strings
+    return hash_bytes(hash, str, strlen(str) + 1);
+}
+
+static char* get_path(const char* dir, const char* name) {
+
+    size_t size = strlen(dir) + strlen(name) + 2;
+    char* path = _ALLOC(size);
+    snprintf(path, size, "%s/%s", dir, name);
+
+    return path;
+}
+
+/*
+ * Return the entry of the file or the empty slot where it belongs.
+ */
+static emit_sum_t** find_sum(emit_manifest_t* manifest, const char* name) {
+
+    size_t idx = hash_string((size_t)0xcbf29ce484222325ULL, name) & (manifest->cap - 1);
+
+    while(manifest->table[idx] != NULL && strcmp(manifest->table[idx]->name, name))
+        idx = (idx + 1) & (manifest->cap - 1);
+
+    return &manifest->table[idx];
+}
+
+static void add_sum(emit_manifest_t* manifest, emit_sum_t* sum) {
+
+    if((manifest->len + 1) * 2 > manifest->cap) {
+        emit_sum_t** old = manifest->table;
+        size_t old_cap = manifest->cap;
+
+        manifest->cap <<= 1;
+        manifest->table = _ALLOC_ARRAY(emit_sum_t*, manifest->cap);
+        for(size_t i = 0; i < old_cap; i++) {
+            if(old[i] != NULL)
+                *find_sum(manifest, old[i]->name) = old[i];
+        }
+        _FREE(old);
+    }
+
+    emit_sum_t** slot = find_sum(manifest, sum->name);
+    if(*slot == NULL) {
+        *slot = _COPY_DS(sum, emit_sum_t);
+        (*slot)->name = _COPY_STRING(sum->name);
+        manifest->len++;
+    }
+}
+
+/*
+ * Read the manifest that was left in the directory by the last run. A line
+ * that cannot be read is ignored, so its file is made again.
+ */
+static emit_manifest_t* load_manifest(const char* dir) {
+
+    emit_manifest_t* manifest = _ALLOC_DS(emit_manifest_t);
+    manifest->cap = 1 << 8;
+    manifest->table = _ALLOC_ARRAY(emit_sum_t*, manifest->cap);
+
+    char* path = get_path(dir, MANIFEST_NAME);
+    FILE* fp = fopen(path, "r");
+    _FREE(path);
+
+    if(fp != NULL) {
+        char line[1024];
+        char name[1024];
+        emit_sum_t sum = { name, 0, 0, 0, 0, 0, false };
+
+        while(fgets(line, sizeof(line), fp) != NULL) {
+            if(sscanf(line, "%zx %zx %zu %lld %ld %1023s", &sum.key, &sum.hash, &sum.size,
+                      &sum.sec, &sum.nsec, name) == 6)
+                add_sum(manifest, &sum);
+        }
+        fclose(fp);
+    }
+
+    return manifest;
+}
+
+static void destroy_manifest(emit_manifest_t* manifest) {
+
+    for(size_t i = 0; i < manifest->cap; i++) {
+        if(manifest->table[i] != NULL) {
+            _FREE(manifest->table[i]->name);
+            _FREE(manifest->table[i]);
+        }
+    }
+
+    _FREE(manifest->table);
+    _FREE(manifest);
+}
+
+/*
+ * Record the size and the time of the file in the entry. Return false if
+ * there is no file.
+ */
+static bool stat_file(const char* dir, emit_sum_t* sum) {
+
+    struct stat st;
+    char* path = get_path(dir, sum->name);
+    int status = stat(path, &st);
+    _FREE(path);
+
+    if(status != 0)
+        return false;
+
+    sum->size = st.st_size;
+    sum->sec = st.st_mtim.tv_sec;
+    sum->nsec = st.st_mtim.tv_nsec;
+
+    return true;
+}
+
+/*
+ * True if the file is still what the manifest says was written.
+ */
+static bool is_current(const char* dir, emit_sum_t* old) {
+
+    emit_sum_t now = *old;
+
+    return stat_file(dir, &now) && now.size == old->size &&
+           now.sec == old->sec && now.nsec == old->nsec;
+}
+
+/*
+ * Write the buffers to the file in one go. Return 0 or the errno of the
+ * failure.
+ */
+static int write_file(const char* dir, const char* name, out_buffer_t** bufs, int num) {
+
+    char* path = get_path(dir, name);
+    int status = write_out_file(path, bufs, num);
+    _FREE(path);
+
+    return status;
+}
+
+/*
+ * True if the file has the same content as the buffers.
+ */
+static bool same_file(const char* dir, const char* name, out_buffer_t** bufs, int num) {
+
+    char* path = get_path(dir, name);
+    FILE* fp = fopen(path, "r");
+    _FREE(path);
+
+    if(fp == NULL)
+        return false;
+
+    size_t len = 0;
+    for(int i = 0; i < num; i++)
+        len += bufs[i]->len;
+
+    char* text = _ALLOC(len + 1);
+    size_t text_len = fread(text, 1, len + 1, fp);
+    fclose(fp);
+
+    bool same = text_len == len;
+    for(int i = 0, pos = 0; same && i < num; pos += bufs[i++]->len)
+        same = !memcmp(&text[pos], bufs[i]->text, bufs[i]->len);
+    _FREE(text);
+
+    return same;
+}
+
+/*
+ * Take the entry of the file from the old manifest. The name stays the one
+ * of the caller.
+ */
+static void copy_sum(emit_sum_t* sum, emit_sum_t* old) {
+
+    char* name = sum->name;
+    *sum = *old;
+    sum->name = name;
+}
+
+/*
+ * Write the text to the file unless the manifest shows that it is already
+ * there. A file that was touched since the manifest was written is read to
+ * find out. The entry is filled in for the new manifest.
+ */
+static int update_file(const char* dir, emit_manifest_t* manifest, emit_sum_t* sum,
+                       out_buffer_t** bufs, int num, bool* written) {
+
+    emit_sum_t* old = *find_sum(manifest, sum->name);
+    size_t len = 0;
+
+    sum->hash = (size_t)0xcbf29ce484222325ULL;
+    for(int i = 0; i < num; i++) {
+        sum->hash = hash_bytes(sum->hash, bufs[i]->text, bufs[i]->len);
+        len += bufs[i]->len;
+    }
+    *written = false;
+
+    if(old != NULL && old->hash == sum->hash && old->size == len && is_current(dir, old)) {
+        copy_sum(sum, old);
+        return 0;
+    }
+
+    if(same_file(dir, sum->name, bufs, num)) {
+        stat_file(dir, sum);
+        return 0;
+    }
+
+    int status = write_file(dir, sum->name, bufs, num);
+    if(status == 0) {
+        stat_file(dir, sum);
+        *written = true;
+    }
+
+    return status;
+}
+
+typedef struct {
+    symbol_table_t* tab;
+    size_t key;
+} emit_key_t;
+
+/*
+ * The rule only uses the name of a terminal that the scanner returns, which
+ * comes from the symbol table and so can be changed by another rule.
+ */
+static void emit_key_pre(ast_node_t* node, void* state) {
+
+    emit_key_t* ctx = (emit_key_t*)state;
+
+    if(node->type == AST_RULE_ELEMENT) {
+        ast_rule_element_t* elem = (ast_rule_element_t*)node;
+        if(elem->term != NULL && elem->term->type != NON_TERMINAL)
+            ctx->key = hash_string(ctx->key, find_symbol(ctx->tab, elem->term->text)->decorated);
+    }
+}
+
+/*
+ * The options that change the file of a rule.
+ */
+static size_t hash_options(size_t key, emit_options_t* opts) {
+
+    char flags[] = { opts->amalgamate, opts->compact, opts->typed };
+
+    return hash_bytes(key, flags, sizeof(flags));
+}
+
+/*
+ * The key of a rule file is made from everything that goes into it, which
+ * is the rule, the names of its terminals, the name of the grammar and the
+ * options.
+ */
+static size_t get_rule_key(symbol_table_t* tab, ast_non_terminal_rule_t* rule, const char* grammar,
+                           emit_options_t* opts) {
+
+    out_buffer_t* buf = create_out_buffer();
+    ast_regurge(rule, buf);
+
+    emit_key_t ctx = { tab, (size_t)0xcbf29ce484222325ULL };
+    ctx.key = hash_string(ctx.key, EMIT_VERSION);
+    ctx.key = hash_string(ctx.key, grammar);
+    ctx.key = hash_options(ctx.key, opts);
+    ctx.key = hash_bytes(ctx.key, buf->text, buf->len);
+
+    ast_state_t state = { (ast_callback_t)emit_key_pre, NULL, &ctx };
+    traverse_ast_node(rule, &state);
+
+    destroy_out_buffer(buf);
+    return ctx.key;
+}
+
+/*
+ * Errors are kept by the thread that has them, so a task only records the
+ * failure and it is reported when the tasks are finished. The manifest is
+ * only read by the tasks.
+ */
+static void emit_rule_task(emit_task_t* task) {
+
+    // the C file of an amalgamated parser is written when all of the rules
+    // are finished
+    if(task->opts->amalgamate) {
+        task->bufs[0] = create_out_buffer();
+        task->bufs[1] = create_out_buffer();
+        emit_rule_file(task->bufs[0], task->bufs[1], task->tab, task->rule, task->grammar, task->opts);
+        task->rendered = true;
+        return;
+    }
+
+    emit_sum_t* old = *find_sum(task->manifest, task->sum.name);
+
+    task->sum.key = get_rule_key(task->tab, task->rule, task->grammar, task->opts);
+
+    if(old != NULL && old->key == task->sum.key && is_current(task->dir, old)) {
+        copy_sum(&task->sum, old);
+        return;
+    }
+
+    // the head of the file is made after the body, so they are written
+    // together with writev
+    out_buffer_t* bufs[2] = { create_out_buffer(), create_out_buffer() };
+    emit_rule_file(bufs[0], bufs[1], task->tab, task->rule, task->grammar, task->opts);
+
+    task->rendered = true;
+    task->status = update_file(task->dir, task->manifest, &task->sum, bufs, 2, &task->written);
+
+    destroy_out_buffer(bufs[0]);
+    destroy_out_buffer(bufs[1]);
+}
+
+/*
+ * Remove the files that were made by the last run and not by this one, such
+ * as the file of a rule that was deleted.
+ */
+static int remove_stale(const char* dir, emit_manifest_t* manifest) {
+
+    int count = 0;
+
+    for(size_t i = 0; i < manifest->cap; i++) {
+        emit_sum_t* sum = manifest->table[i];
+        if(sum != NULL && !sum->used) {
+            char* path = get_path(dir, sum->name);
+            if(unlink(path) == 0)
+                count++;
+            _FREE(path);
+        }
+    }
+
+    return count;
+}
+
+/*
+ * The manifest is only written when it changed, so that a run that writes
+ * nothing changes nothing in the directory.
+ */
+static int write_manifest(const char* dir, out_buffer_t* buf) {
+
+    if(same_file(dir, MANIFEST_NAME, &buf, 1))
+        return 0;
+
+    return write_file(dir, MANIFEST_NAME, &buf, 1);
+}
+
+static void print_manifest(out_buffer_t* buf, emit_sum_t* sum) {
+
+    char line[128];
+
+    snprintf(line, sizeof(line), "%016zx %016zx %zu %lld %ld ", sum->key, sum->hash, sum->size,
+             sum->sec, sum->nsec);
+    add_out_string(buf, line);
+    add_out_string(buf, sum->name);
+    add_out_char(buf, '\n');
+}
+
+/*
+ * Write a file that depends on all of the rules if it changed and add it to
+ * the new manifest. Return true if it was written.
+ */
+static bool add_file(const char* dir, emit_manifest_t* manifest, out_buffer_t* text,
+                     char* name, out_buffer_t** bufs, int num) {
+
+    emit_sum_t sum = { name, 0, 0, 0, 0, 0, false };
+    bool written;
+
+    int status = update_file(dir, manifest, &sum, bufs, num, &written);
+    if(status != 0)
+        misc_error("cannot write %s/%s: %s", dir, name, strerror(status));
+    else {
+        print_manifest(text, &sum);
+        emit_sum_t* old = *find_sum(manifest, name);
+        if(old != NULL)
+            old->used = true;
+    }
+
+    return written;
+}
+
+/*
+ * The C file of an amalgamated parser is the start of the file followed by
+ * the head and the body of every rule.
+ */
+static bool add_source_file(const char* dir, emit_manifest_t* manifest, out_buffer_t* text,
+                            symbol_table_t* tab, const char* grammar, emit_options_t* opts,
+                            emit_task_t* tasks, int len) {
+
+    int num = 1 + 2 * len;
+    out_buffer_t** bufs = _ALLOC_ARRAY(out_buffer_t*, num);
+
+    bufs[0] = create_out_buffer();
+    emit_source_file(bufs[0], tab, grammar, opts);
+    for(int i = 0; i < len; i++) {
+        bufs[1 + 2 * i] = tasks[i].bufs[0];
+        bufs[2 + 2 * i] = tasks[i].bufs[1];
+    }
+
+    bool written = add_file(dir, manifest, text, "parser.c", bufs, num);
+
+    destroy_out_buffer(bufs[0]);
+    _FREE(bufs);
+
+    return written;
+}
+
+/*
+ * Write a C file for every non-terminal rule in the grammar and the header
+ * that they share into the directory, or one C file for all of them when
+ * the parser is amalgamated. A parser that is not amalgamated also has a C
+ * file with the runtime and the entry point, which has the code that the
+ * rules share as well when it is compact. The grammar is the name of the
+ * input for the comments. Return the number of errors.
+ */
+int emit_parser(ast_grammar_t* ast, const char* grammar, const char* dir, emit_options_t* opts) {
+
+    int errors = get_errors();
+
+    symbol_table_t* tab = create_symbol_table();
+    ast_pass_manager_t* mgr = create_pass_manager();
+    add_emit_pass1(mgr, tab, grammar);
+    run_passes(mgr, ast);
+    destroy_pass_manager(mgr);
+
+    if(get_errors() != errors) {
+        destroy_symbol_table(tab);
+        return get_errors() - errors;
+    }
+
+    // the rule would have the same file as the runtime
+    symbol_t* sym = find_symbol(tab, RUNTIME_RULE);
+    if(!opts->amalgamate && sym != NULL && sym->type == NON_TERMINAL) {
+        misc_error("%s: a parser that is not amalgamated cannot have a rule named %s", grammar, RUNTIME_RULE);
+        destroy_symbol_table(tab);
+        return get_errors() - errors;
+    }
+
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        misc_error("cannot create directory %s: %s", dir, strerror(errno));
+        destroy_symbol_table(tab);
+        return get_errors() - errors;
+    }
+
+    // the path is only used in the comments, so they do not change with it
+    const char* base = strrchr(grammar, '/');
+    base = (base != NULL) ? base + 1 : grammar;
+
+    emit_manifest_t* manifest = load_manifest(dir);
+
+    int len = len_pointer_list(tab->nterms);
+    emit_task_t* tasks = _ALLOC_ARRAY(emit_task_t, len);
+    thread_pool_t* pool = create_thread_pool(opts->threads);
+
+    for(int i = 0; i < len; i++) {
+        symbol_t* sym = index_pointer_list(tab->nterms, i);
+        size_t size = strlen(sym->name) + 3;
+
+        tasks[i].rule = (ast_non_terminal_rule_t*)sym->def;
+        tasks[i].tab = tab;
+        tasks[i].manifest = manifest;
+        tasks[i].opts = opts;
+        tasks[i].grammar = base;
+        tasks[i].dir = dir;
+        tasks[i].sum.name = _ALLOC(size);
+        snprintf(tasks[i].sum.name, size, "%s.c", sym->name);
+        add_thread_pool_task(pool, (thread_task_t)emit_rule_task, &tasks[i]);
+    }
+
+    wait_thread_pool(pool);
+    destroy_thread_pool(pool);
+
+    out_buffer_t* text = create_out_buffer();
+
+    int rendered = 0;
+    int written = 0;
+
+    for(int i = 0; i < len && !opts->amalgamate; i++) {
+        emit_sum_t* old = *find_sum(manifest, tasks[i].sum.name);
+        if(old != NULL)
+            old->used = true;
+
+        if(tasks[i].status != 0)
+            misc_error("cannot write %s/%s: %s", dir, tasks[i].sum.name, strerror(tasks[i].status));
+        else
+            print_manifest(text, &tasks[i].sum);
+
+        written += tasks[i].written;
+    }
+
+    for(int i = 0; i < len; i++)
+        rendered += tasks[i].rendered;
+
+    if(opts->amalgamate)
+        written += add_source_file(dir, manifest, text, tab, base, opts, tasks, len);
+
+    if(!opts->amalgamate) {
+        out_buffer_t* runtime = create_out_buffer();
+        emit_runtime_file(runtime, tab, base, opts);
+        written += add_file(dir, manifest, text, RUNTIME_NAME, &runtime, 1);
+        destroy_out_buffer(runtime);
+    }
+
+    // the header is always rendered because it depends on all of the rules
+    out_buffer_t* header = create_out_buffer();
+    emit_header_file(header, tab, base, opts);
+    written += add_file(dir, manifest, text, "parser.h", &header, 1);
+
+    // the files of the other layout are removed here as well
+    int removed = remove_stale(dir, manifest);
+
+    int status = write_manifest(dir, text);
+    if(status != 0)
+        misc_error("cannot write %s/%s: %s", dir, MANIFEST_NAME, strerror(status));
+
+#ifdef TRACE_EMIT
+    fprintf(stderr, "TRACE: %s: %d rules rendered, %d files written, %d removed\n",
+            dir, rendered, written, removed);
+#else
+    (void)rendered;
+    (void)removed;
+#endif
+
+    destroy_out_buffer(header);
+    destroy_out_buffer(text);
+    for(int i = 0; i < len; i++) {
+        destroy_out_buffer(tasks[i].bufs[0]);
+        destroy_out_buffer(tasks[i].bufs[1]);
+        _FREE(tasks[i].sum.name);
+    }
+    _FREE(tasks);
+    destroy_manifest(manifest);
+    destroy_symbol_table(tab);
+
+    return get_errors() - errors;
+}
@@ -1,5 +1,25 @@
 #ifndef _EMIT_H_
 #define _EMIT_H_
 
+#include <stdbool.h>
+
+#include "ast.h"
+
+/*
+ * The options of the emitter. When the parser is amalgamated, it is one C
+ * file with the rules, the token queue and the AST code in it, so that the
+ * compiler sees all of it at once. A compact parser is smaller and slower,
+ * because its rules call shared code in place of having state machines. A
+ * typed parser gives every rule a struct with a field for each element, and
+ * is only amalgamated, because it has its own AST code.
+ */
+typedef struct {
+    int threads;
+    bool amalgamate;
+    bool compact;
+    bool typed;
+} emit_options_t;
+
+int emit_parser(ast_grammar_t* ast, const char* grammar, const char* dir, emit_options_t* opts);
 
 #endif /* _EMIT_H_ */
@@ -1,11 +1,237 @@
 /*
- * Pass 1 generates the lists.
+ * Pass 1 generates the lists. Every name in the grammar is interned in a
+ * symbol table and given a dense id. The table records where the symbol is
+ * defined and the rules that refer to it, so that the later passes can
+ * resolve a rule element by its name without searching the rules.
  */
 
+#include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "ast.h"
+#include "ast_pass.h"
+#include "emit_pass1.h"
 #include "errors.h"
 #include "memory.h"
 #include "regurge.h"
 
+static size_t hash_name(const char* str) {
+
+    size_t hash = (size_t)0xcbf29ce484222325ULL;
+
+    while(*str != '\0') {
+        hash ^= (unsigned char)*str++;
+        hash *= (size_t)0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void insert_symbol(symbol_table_t* tab, symbol_t* sym) {
+
+    size_t idx = sym->hash & (tab->cap - 1);
+
+    while(tab->table[idx] != NULL)
+        idx = (idx + 1) & (tab->cap - 1);
+
+    tab->table[idx] = sym;
+}
+
+static void grow_symbol_table(symbol_table_t* tab) {
+
+    symbol_t** old = tab->table;
+    size_t old_cap = tab->cap;
+
+    tab->cap <<= 1;
+    tab->table = _ALLOC_ARRAY(symbol_t*, tab->cap);
+
+    for(size_t i = 0; i < old_cap; i++) {
+        if(old[i] != NULL)
+            insert_symbol(tab, old[i]);
+    }
+
+    _FREE(old);
+}
+
+/*
+ * Return the slot that holds the name or the empty slot where it belongs.
+ */
+static size_t find_slot(symbol_table_t* tab, const char* name, size_t hash) {
+
+    size_t idx = hash & (tab->cap - 1);
+
+    while(tab->table[idx] != NULL) {
+        if(tab->table[idx]->hash == hash && !strcmp(tab->table[idx]->name, name))
+            break;
+        idx = (idx + 1) & (tab->cap - 1);
+    }
+
+    return idx;
+}
+
+symbol_table_t* create_symbol_table(void) {
+
+    symbol_table_t* ptr = _ALLOC_DS(symbol_table_t);
+    ptr->cap = 1 << 8;
+    ptr->len = 0;
+    ptr->table = _ALLOC_ARRAY(symbol_t*, ptr->cap);
+    ptr->nterms = create_pointer_list();
+    ptr->terms = create_pointer_list();
+    ptr->crnt = NULL;
+    ptr->grammar = NULL;
+
+    return ptr;
+}
+
+void destroy_symbol_table(symbol_table_t* tab) {
+
+    if(tab != NULL) {
+        for(size_t i = 0; i < tab->cap; i++) {
+            symbol_t* sym = tab->table[i];
+            if(sym != NULL) {
+                destroy_pointer_list(sym->refs);
+                _FREE(sym->name);
+                _FREE(sym->decorated);
+                _FREE(sym);
+            }
+        }
+
+        destroy_pointer_list(tab->nterms);
+        destroy_pointer_list(tab->terms);
+        _FREE(tab->table);
+        _FREE(tab);
+    }
+}
+
+/*
+ * Return the symbol for the text of the token, adding it if it is not in
+ * the table. The table keeps its own copy of the name.
+ */
+symbol_t* intern_symbol(symbol_table_t* tab, token_t* tok) {
+
+    assert(tab != NULL);
+    assert(tok != NULL);
+
+    size_t hash = hash_name(tok->text);
+    size_t idx = find_slot(tab, tok->text, hash);
+
+    if(tab->table[idx] != NULL)
+        return tab->table[idx];
+
+    symbol_t* sym = _ALLOC_DS(symbol_t);
+    sym->name = _COPY_STRING(tok->text);
+    sym->decorated = _COPY_STRING((tok->name != NULL) ? tok->name : tok->text);
+    sym->type = tok->type;
+    sym->line_no = tok->line_no;
+    sym->hash = hash;
+    sym->def = NULL;
+    sym->refs = create_pointer_list();
+
+    if(tok->type == NON_TERMINAL) {
+        sym->id = len_pointer_list(tab->nterms);
+        add_pointer_list(tab->nterms, sym);
+    }
+    else {
+        sym->id = len_pointer_list(tab->terms);
+        add_pointer_list(tab->terms, sym);
+    }
+
+    tab->table[idx] = sym;
+    tab->len++;
+
+    if(tab->len * 2 > tab->cap)
+        grow_symbol_table(tab);
+
+    return sym;
+}
+
+/*
+ * Return the symbol with the name or NULL if there is none.
+ */
+symbol_t* find_symbol(symbol_table_t* tab, const char* name) {
+
+    assert(tab != NULL);
+    assert(name != NULL);
+
+    return tab->table[find_slot(tab, name, hash_name(name))];
+}
+
+static void define_symbol(symbol_table_t* tab, token_t* tok, ast_node_t* node) {
+
+    symbol_t* sym = intern_symbol(tab, tok);
+
+    if(sym->def != NULL)
+        syntax_error(tab->grammar, tok->line_no,
+                     "%s is already defined on line %d", tok->text, sym->line_no);
+    else {
+        sym->def = node;
+        sym->line_no = tok->line_no;
+    }
+}
+
+/*
+ * This function is entered before the node is traversed.
+ */
+static void emit_pass1_pre(ast_node_t* node, void* state) {
+
+    symbol_table_t* tab = (symbol_table_t*)state;
+
+    switch(node->type) {
+        case AST_NON_TERMINAL_RULE:
+            tab->crnt = (ast_non_terminal_rule_t*)node;
+            define_symbol(tab, tab->crnt->nterm, node);
+            break;
+        case AST_TERMINAL_RULE:
+            define_symbol(tab, ((ast_terminal_rule_t*)node)->term_sym, node);
+            break;
+        case AST_RULE_ELEMENT: {
+            ast_rule_element_t* elem = (ast_rule_element_t*)node;
+            if(elem->term != NULL)
+                add_pointer_list(intern_symbol(tab, elem->term)->refs, tab->crnt);
+        } break;
+        case AST_GRAMMAR:
+        case AST_ONE_OR_MORE_FUNC:
+        case AST_ZERO_OR_ONE_FUNC:
+        case AST_ZERO_OR_MORE_FUNC:
+        case AST_OR_FUNC:
+        case AST_GROUP_FUNC:
+            break;
+        default:
+            fatal_error("unknown state in %s", __func__);
+    }
+}
+
+/*
+ * This function is entered after the node is traversed. When the grammar is
+ * finished, every non-terminal that is used must have a rule. Terminals that
+ * are not defined are provided by the scanner.
+ */
+static void emit_pass1_post(ast_node_t* node, void* state) {
+
+    symbol_table_t* tab = (symbol_table_t*)state;
+
+    if(node->type == AST_NON_TERMINAL_RULE)
+        tab->crnt = NULL;
+    else if(node->type == AST_GRAMMAR) {
+        int post = 0;
+        symbol_t* sym;
+
+        while(NULL != (sym = iterate_pointer_list(tab->nterms, &post))) {
+            if(sym->def == NULL)
+                syntax_error(tab->grammar, sym->line_no, "%s is not defined", sym->name);
+        }
+    }
+}
+
+/*
+ * Register the pass. The symbol table is the state of the pass and belongs
+ * to the caller. The grammar is the name of the input for the errors, as the
+ * scanner may be closed by the time that the pass runs.
+ */
+ast_pass_t* add_emit_pass1(ast_pass_manager_t* mgr, symbol_table_t* tab, const char* grammar) {
+
+    tab->grammar = grammar;
+    return add_pass(mgr, "emit_pass1", (ast_callback_t)emit_pass1_pre,
+                    (ast_callback_t)emit_pass1_post, tab);
+}
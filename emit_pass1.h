@@ -1,5 +1,51 @@
 #ifndef _EMIT_PASS1_H_
 #define _EMIT_PASS1_H_
 
+#include <stddef.h>
+
+#include "ast.h"
+#include "ast_pass.h"
+#include "pointer_list.h"
+#include "scanner.h"
+
+/*
+ * A name in the grammar. The non-terminals and the terminals are numbered
+ * separately from 0 in the order that they are first seen, so the id can be
+ * used to index the tables of the later passes. Decorated is the name of the
+ * token that the scanner returns for a terminal. Def is the rule that defines
+ * the symbol, or NULL if there is none. Refs is the non-terminal rule that
+ * contains every reference to the symbol.
+ */
+typedef struct _symbol_t_ {
+    const char* name;
+    const char* decorated;
+    token_type_t type;
+    int id;
+    int line_no;
+    size_t hash;
+    ast_node_t* def;
+    pointer_list_t* refs;
+} symbol_t;
+
+/*
+ * The symbols are kept in an open addressing hash table of the names and in
+ * a list for each kind that is indexed by the id. Grammar is the name of the
+ * input for the errors of pass 1.
+ */
+typedef struct _symbol_table_t_ {
+    symbol_t** table;
+    size_t cap;
+    size_t len;
+    pointer_list_t* nterms;
+    pointer_list_t* terms;
+    ast_non_terminal_rule_t* crnt;
+    const char* grammar;
+} symbol_table_t;
+
+symbol_table_t* create_symbol_table(void);
+void destroy_symbol_table(symbol_table_t* tab);
+symbol_t* intern_symbol(symbol_table_t* tab, token_t* tok);
+symbol_t* find_symbol(symbol_table_t* tab, const char* name);
+ast_pass_t* add_emit_pass1(ast_pass_manager_t* mgr, symbol_table_t* tab, const char* grammar);
 
 #endif /* _EMIT_PASS1_H_ */
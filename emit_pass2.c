@@ -1,11 +1,1641 @@
 /*
- * Pass 2 generates the rule list and places the comment block in it.
+ * Pass 2 generates the rule list and places the comment block in it. Every
+ * non-terminal rule is rendered as a C file that holds a state machine like
+ * the ones in parser.c, with the rule as the comment above it. The groups
+ * and the functions in the rule are rendered as static helpers in the same
+ * file. The header has the tokens, the AST types and the prototypes of all
+ * of the rules.
+ *
+ * A compact parser has the same files, but a function is a list of calls
+ * to code that all of the rules share, rather than a state machine.
+ *
+ * A typed parser has the same state machines, but every rule has a struct
+ * with a field for each of its elements in place of the list of elements.
+ * The struct of a group is a part of the struct of its rule, and its helper
+ * fills it in.
+ *
+ * The code is made from the templates of the backend, which are in
+ * emit_templates.c. The functions here decide which templates are used and
+ * fill in their slots.
+ *
+ * Nothing here writes to the AST or the symbol table, so the rules can be
+ * rendered at the same time on different threads.
  */
+#define _POSIX_C_SOURCE 200809L
 
-#include <stdio.h>
+#include <assert.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "ast.h"
+#include "emit_pass1.h"
+#include "emit_pass2.h"
+#include "emit_templates.h"
 #include "errors.h"
 #include "memory.h"
+#include "out_buffer.h"
 #include "regurge.h"
+#include "template.h"
+#include "vector.h"
 
+#define MATCH_STATE 1000
+#define NO_MATCH_STATE 2000
+#define ERROR_STATE 3000
+
+/*
+ * A list of rule elements that is rendered as one function. Node is the
+ * part of the rule that it came from and is used for the comment. Slot is
+ * set when the list is a single non-terminal, which a typed helper stores
+ * without a struct of its own.
+ */
+typedef struct {
+    ast_node_t* node;
+    void** items;
+    int len;
+    bool slot;
+} emit_helper_t;
+
+DEFINE_VECTOR(emit_helper_list, emit_helper_t, 8)
+
+/*
+ * The field of a typed struct that an element is stored in. Base is what
+ * the field is named for, or NULL for a group, which is named for its
+ * helper. Call is the rule of a field that holds nodes. Num tells apart the
+ * fields of an alternative that have the same name.
+ */
+typedef enum {
+    FIELD_TERM,
+    FIELD_NTERM,
+    FIELD_PART,
+    FIELD_OPTIONAL_PART,
+    FIELD_TERM_LIST,
+    FIELD_NTERM_LIST,
+    FIELD_PART_LIST,
+} emit_field_kind_t;
+
+typedef struct {
+    emit_field_kind_t kind;
+    const char* base;
+    const char* call;
+    int index;
+    int num;
+} emit_field_t;
+
+/*
+ * An element of a list with the state that tries it. Alternatives are
+ * separated by the or functions. The element is committed when a required
+ * element before it in the same alternative has matched, so a failure is an
+ * error rather than a reason to try the next alternative. A one or more
+ * function has a second state that loops.
+ */
+typedef struct {
+    ast_rule_element_t* elem;
+    int alt;
+    int state;
+    int loop;
+    bool first;
+    bool committed;
+    emit_field_t field;
+} emit_item_t;
+
+DEFINE_VECTOR(emit_item_list, emit_item_t, 16)
+
+/*
+ * The body of a function is rendered before its head, because the head
+ * depends on what the body uses. The buffers are reused for every function
+ * and the values are the slots of the templates. A typed function has a
+ * target, which is the type that it stores to, and a struct with
+ * alternatives is tagged.
+ */
+typedef struct {
+    symbol_table_t* tab;
+    const char* name;
+    emit_helper_list_t helpers;
+    out_buffer_t* upper;
+    out_buffer_t* body;
+    out_buffer_t* comment;
+    out_buffer_t* expected;
+    out_buffer_t* cond;
+    out_buffer_t* field;
+    out_buffer_t* target;
+    out_buffer_t* clear;
+    template_value_t vals[EMIT_NUM_SLOTS];
+    bool nterm;
+    bool mark;
+    bool compact;
+    bool typed;
+    bool tagged;
+    bool slot;
+    int index;
+} emit_rule_t;
+
+/*
+ * The templates are compiled the first time that a file is rendered and
+ * are kept until the program exits.
+ */
+static template_t* templates[EMIT_NUM_TEMPLATES];
+static pthread_once_t templates_once = PTHREAD_ONCE_INIT;
+
+static void compile_templates(void) {
+
+    for(int i = 0; i < EMIT_NUM_TEMPLATES; i++)
+        templates[i] = compile_template(c_templates[i], emit_slots, EMIT_NUM_SLOTS);
+}
+
+static inline void emit(out_buffer_t* buf, emit_template_t id, template_value_t* vals) {
+
+    render_template(buf, templates[id], vals);
+}
+
+static void emit_upper(out_buffer_t* buf, const char* str) {
+
+    while(*str != '\0')
+        add_out_char(buf, toupper((unsigned char)*str++));
+}
+
+/*
+ * The states that end the machine are used by name.
+ */
+static template_value_t get_state(int state) {
+
+    switch(state) {
+        case MATCH_STATE:
+            return template_string("MATCH_STATE");
+        case NO_MATCH_STATE:
+            return template_string("NO_MATCH_STATE");
+        case ERROR_STATE:
+            return template_string("ERROR_STATE");
+        default:
+            return template_int(state);
+    }
+}
+
+/*
+ * The state after this one. The states that end the machine are skipped.
+ */
+static int next_state(int state, int step) {
+
+    state += step;
+    if(state % 1000 == 0)
+        state += step;
+
+    return state;
+}
+
+static ast_node_t* get_func(ast_rule_element_t* elem) {
+
+    return (elem->term == NULL) ? elem->nterm : NULL;
+}
+
+static bool is_term(ast_rule_element_t* elem) {
+
+    return elem->term != NULL && elem->term->type != NON_TERMINAL;
+}
+
+static ast_rule_element_t* skip_or(ast_rule_element_t* elem) {
+
+    ast_node_t* func;
+
+    while(NULL != (func = get_func(elem)) && func->type == AST_OR_FUNC)
+        elem = ((ast_or_func_t*)func)->elem;
+
+    return elem;
+}
+
+/*
+ * An element that can only match one token is a terminal or a group with
+ * one terminal in each of its alternatives.
+ */
+static bool is_term_set(ast_rule_element_t* elem) {
+
+    ast_node_t* func = get_func(elem);
+
+    if(func == NULL)
+        return is_term(elem);
+    if(func->type != AST_GROUP_FUNC)
+        return false;
+
+    pointer_list_t* list = ((ast_group_func_t*)func)->list;
+    for(int i = 0; i < list->len; i++) {
+        ast_rule_element_t* item = list->list[i];
+        if(i > 0 && (get_func(item) == NULL || get_func(item)->type != AST_OR_FUNC))
+            return false;
+        if(!is_term(skip_or(item)))
+            return false;
+    }
+
+    return list->len > 0;
+}
+
+static bool is_required(ast_rule_element_t* elem) {
+
+    ast_node_t* func = get_func(elem);
+
+    return func == NULL || (func->type != AST_ZERO_OR_ONE_FUNC && func->type != AST_ZERO_OR_MORE_FUNC);
+}
+
+/*
+ * The text of a node as it was read, with the white space in it collapsed.
+ */
+static out_buffer_t* get_node_text(ast_node_t* node) {
+
+    out_buffer_t* buf = create_out_buffer();
+    ast_regurge(node, buf);
+
+    char* text = buf->text;
+    char* dst = text;
+    for(char* src = text; *src != '\0'; src++) {
+        if(!isspace((unsigned char)*src))
+            *dst++ = *src;
+        else if(dst > text && dst[-1] != ' ')
+            *dst++ = ' ';
+    }
+
+    while(dst > text && dst[-1] == ' ')
+        dst--;
+    *dst = '\0';
+    buf->len = dst - text;
+
+    return buf;
+}
+
+/*
+ * The comment is the node as it was read. A "*" followed by "/" in an
+ * operator would end the comment, so it is broken up.
+ */
+static void emit_comment(out_buffer_t* buf, ast_node_t* node) {
+
+    out_buffer_t* tmp = create_out_buffer();
+    ast_regurge(node, tmp);
+
+    add_out_string(buf, "/*\n");
+
+    bool first = true;
+    char* save;
+    for(char* line = strtok_r(tmp->text, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        while(isspace((unsigned char)*line))
+            line++;
+
+        char* end = line + strlen(line);
+        while(end > line && isspace((unsigned char)end[-1]))
+            end--;
+        *end = '\0';
+
+        if(*line == '\0')
+            continue;
+
+        add_out_string(buf, (first || !strcmp(line, "}")) ? " * " : " *     ");
+        for(char* ch = line; *ch != '\0'; ch++) {
+            add_out_char(buf, *ch);
+            if(ch[0] == '*' && ch[1] == '/')
+                add_out_char(buf, ' ');
+        }
+        add_out_char(buf, '\n');
+        first = false;
+    }
+
+    add_out_string(buf, " */\n");
+    destroy_out_buffer(tmp);
+}
+
+/*
+ * A C string that has the text of the node, for the error messages.
+ */
+static void emit_string(out_buffer_t* buf, ast_node_t* node) {
+
+    out_buffer_t* text = get_node_text(node);
+
+    add_out_char(buf, '\"');
+    for(char* ch = text->text; *ch != '\0'; ch++) {
+        if(*ch == '\"' || *ch == '\\')
+            add_out_char(buf, '\\');
+        add_out_char(buf, *ch);
+    }
+    add_out_char(buf, '\"');
+
+    destroy_out_buffer(text);
+}
+
+/*
+ * The test of the current token against the terminals of a set.
+ */
+static void emit_term_set(emit_rule_t* ctx, out_buffer_t* buf, ast_rule_element_t* elem) {
+
+    ast_node_t* func = get_func(elem);
+    ast_rule_element_t** items = (func == NULL) ? &elem : (ast_rule_element_t**)((ast_group_func_t*)func)->list->list;
+    int len = (func == NULL) ? 1 : ((ast_group_func_t*)func)->list->len;
+
+    for(int i = 0; i < len; i++) {
+        if(i > 0)
+            add_out_string(buf, " || ");
+        add_out_string(buf, "TTYPE == ");
+        add_out_string(buf, find_symbol(ctx->tab, skip_or(items[i])->term->text)->decorated);
+    }
+}
+
+/*
+ * Queue a list to be rendered as a helper and return its number. A group is
+ * rendered from its list and anything else is a list of one element.
+ */
+static int add_helper(emit_rule_t* ctx, ast_rule_element_t** slot) {
+
+    emit_helper_t helper;
+    ast_node_t* func = get_func(*slot);
+
+    if(func != NULL && func->type == AST_GROUP_FUNC) {
+        pointer_list_t* list = ((ast_group_func_t*)func)->list;
+        helper.node = func;
+        helper.items = list->list;
+        helper.len = list->len;
+    }
+    else {
+        helper.node = (ast_node_t*)*slot;
+        helper.items = (void**)slot;
+        helper.len = 1;
+    }
+
+    helper.slot = (func == NULL && (*slot)->term->type == NON_TERMINAL);
+    add_emit_helper_list(&ctx->helpers, helper);
+
+    return ctx->helpers.len;
+}
+
+/*
+ * Split the list into alternatives and number the states. An or function
+ * starts a new alternative with the element that it holds.
+ */
+static void split_list(emit_helper_t* list, emit_item_list_t* items) {
+
+    int alt = 0;
+    int last = 0;
+    bool committed = false;
+
+    for(int i = 0; i < list->len; i++) {
+        ast_rule_element_t* elem = list->items[i];
+        ast_node_t* func;
+
+        while(NULL != (func = get_func(elem)) && func->type == AST_OR_FUNC) {
+            if(items->len > 0 && items->list[items->len - 1].alt == alt) {
+                alt++;
+                committed = false;
+            }
+            elem = ((ast_or_func_t*)func)->elem;
+        }
+
+        emit_item_t item = { elem, alt, 0, 0, false, committed, { 0 } };
+
+        if(items->len == 0 || items->list[items->len - 1].alt != alt) {
+            item.first = true;
+            item.state = (last == 0) ? 100 : next_state(last - last % 100, 100);
+        }
+        else
+            item.state = next_state(last, 10);
+
+        last = item.state;
+        // a one or more function over terminals loops in its own state
+        func = get_func(elem);
+        if(func != NULL && func->type == AST_ONE_OR_MORE_FUNC &&
+           !is_term_set(((ast_one_or_more_func_t*)func)->elem)) {
+            item.loop = next_state(item.state, 10);
+            last = item.loop;
+        }
+
+        add_emit_item_list(items, item);
+        committed = committed || is_required(elem);
+    }
+}
+
+/*
+ * The text of the element for the error when it does not match. A one or
+ * more function that fails is missing its first element.
+ */
+static void set_expected(emit_rule_t* ctx, emit_item_t* item) {
+
+    ast_node_t* func = get_func(item->elem);
+    ast_node_t* node = (func != NULL && func->type == AST_ONE_OR_MORE_FUNC) ?
+            (ast_node_t*)((ast_one_or_more_func_t*)func)->elem : (ast_node_t*)item->elem;
+
+    clear_out_buffer(ctx->expected);
+    emit_string(ctx->expected, node);
+    ctx->vals[EMIT_SLOT_EXPECTED] = template_buffer(ctx->expected);
+}
+
+/*
+ * What to do when the element in the item does not match.
+ */
+static void emit_fail(emit_rule_t* ctx, out_buffer_t* buf, emit_item_list_t* items, int idx) {
+
+    emit_item_t* item = &items->list[idx];
+    int alt = NO_MATCH_STATE;
+
+    for(int i = idx + 1; i < items->len; i++) {
+        if(items->list[i].alt != item->alt) {
+            alt = items->list[i].state;
+            break;
+        }
+    }
+
+    if(item->committed) {
+        set_expected(ctx, item);
+        emit(buf, EMIT_FAIL_ERROR, ctx->vals);
+    }
+    else {
+        ctx->vals[EMIT_SLOT_ALT] = get_state(alt);
+        if(item->first || alt == NO_MATCH_STATE) {
+            // a group or a list can be left with a part of what it matched
+            if(ctx->typed && alt != NO_MATCH_STATE && item->field.kind != FIELD_TERM &&
+               item->field.kind != FIELD_NTERM && item->field.kind != FIELD_TERM_LIST)
+                emit(buf, EMIT_TYPED_FAIL_NEXT, ctx->vals);
+            else
+                emit(buf, EMIT_FAIL_NEXT, ctx->vals);
+        }
+        else if(ctx->typed)
+            emit(buf, EMIT_TYPED_FAIL_RESET, ctx->vals);
+        else {
+            emit(buf, EMIT_FAIL_RESET, ctx->vals);
+            ctx->mark = true;
+        }
+    }
+}
+
+static void emit_item(emit_rule_t* ctx, out_buffer_t* buf, emit_item_list_t* items, int idx) {
+
+    emit_item_t* item = &items->list[idx];
+    int next = (idx + 1 < items->len && items->list[idx + 1].alt == item->alt) ?
+            items->list[idx + 1].state : MATCH_STATE;
+    ast_rule_element_t* elem = item->elem;
+    ast_node_t* func = get_func(elem);
+    template_value_t* vals = ctx->vals;
+
+    // a committed element that does not match is an error
+    vals[EMIT_SLOT_STATE] = template_int(item->state);
+    vals[EMIT_SLOT_NEXT] = get_state(next);
+    vals[EMIT_SLOT_LIKELY] = template_bool(item->committed);
+    emit(buf, EMIT_CASE, vals);
+
+    if(func == NULL && elem->term->type == NON_TERMINAL) {
+        vals[EMIT_SLOT_CALL] = template_string(elem->term->text);
+        emit(buf, EMIT_CALL_NTERM, vals);
+        emit_fail(ctx, buf, items, idx);
+        ctx->nterm = true;
+    }
+    else if(func == NULL) {
+        vals[EMIT_SLOT_TERM] = template_string(find_symbol(ctx->tab, elem->term->text)->decorated);
+        emit(buf, EMIT_MATCH_TERM, vals);
+        emit_fail(ctx, buf, items, idx);
+    }
+    else if(func->type == AST_GROUP_FUNC) {
+        vals[EMIT_SLOT_INDEX] = template_int(add_helper(ctx, &item->elem));
+        emit(buf, EMIT_CALL_HELPER, vals);
+        emit_fail(ctx, buf, items, idx);
+    }
+    else if(is_term_set(((ast_or_func_t*)func)->elem)) {
+        // the terminals are taken in a loop here rather than in a helper
+        clear_out_buffer(ctx->cond);
+        emit_term_set(ctx, ctx->cond, ((ast_or_func_t*)func)->elem);
+        vals[EMIT_SLOT_COND] = template_buffer(ctx->cond);
+
+        switch(func->type) {
+            case AST_ZERO_OR_ONE_FUNC:
+                emit(buf, EMIT_TERM_OPTIONAL, vals);
+                break;
+            case AST_ZERO_OR_MORE_FUNC:
+                emit(buf, EMIT_TERM_REPEAT, vals);
+                break;
+            case AST_ONE_OR_MORE_FUNC:
+                emit(buf, EMIT_TERM_MORE, vals);
+                emit_fail(ctx, buf, items, idx);
+                break;
+            default:
+                fatal_error("unknown function in %s: %d", __func__, func->type);
+        }
+    }
+    else {
+        // the functions all have the same layout
+        vals[EMIT_SLOT_INDEX] = template_int(add_helper(ctx, &((ast_or_func_t*)func)->elem));
+
+        switch(func->type) {
+            case AST_ZERO_OR_ONE_FUNC:
+                emit(buf, EMIT_CALL_OPTIONAL, vals);
+                break;
+            case AST_ZERO_OR_MORE_FUNC:
+                emit(buf, EMIT_CALL_REPEAT, vals);
+                break;
+            case AST_ONE_OR_MORE_FUNC:
+                // the first match is required and the loop is not
+                vals[EMIT_SLOT_NEXT] = template_int(item->loop);
+                emit(buf, EMIT_CALL_HELPER, vals);
+                emit_fail(ctx, buf, items, idx);
+                emit(buf, EMIT_BREAK, vals);
+                vals[EMIT_SLOT_STATE] = template_int(item->loop);
+                vals[EMIT_SLOT_NEXT] = get_state(next);
+                emit(buf, EMIT_CASE, vals);
+                emit(buf, EMIT_CALL_REPEAT, vals);
+                break;
+            default:
+                fatal_error("unknown function in %s: %d", __func__, func->type);
+        }
+    }
+
+    emit(buf, EMIT_BREAK, vals);
+}
+
+/*
+ * A compact function is one expression. The items of an alternative are
+ * joined with && and the alternatives with ||, so the shared code stops at
+ * the first item that fails. An item that is committed is given the text
+ * for its error.
+ */
+static void emit_compact_item(emit_rule_t* ctx, out_buffer_t* buf, emit_item_list_t* items, int idx) {
+
+    emit_item_t* item = &items->list[idx];
+    ast_rule_element_t* elem = item->elem;
+    ast_node_t* func = get_func(elem);
+    template_value_t* vals = ctx->vals;
+
+    if(idx > 0)
+        emit(buf, (items->list[idx - 1].alt == item->alt) ? EMIT_COMPACT_AND : EMIT_COMPACT_OR, vals);
+
+    if(item->committed)
+        set_expected(ctx, item);
+    else
+        vals[EMIT_SLOT_EXPECTED] = template_string("NULL");
+
+    if(func == NULL && elem->term->type == NON_TERMINAL) {
+        vals[EMIT_SLOT_CALL] = template_string(elem->term->text);
+        emit(buf, EMIT_COMPACT_NTERM, vals);
+    }
+    else if(func == NULL) {
+        vals[EMIT_SLOT_TERM] = template_string(find_symbol(ctx->tab, elem->term->text)->decorated);
+        emit(buf, EMIT_COMPACT_TERM, vals);
+    }
+    else if(func->type == AST_GROUP_FUNC) {
+        vals[EMIT_SLOT_INDEX] = template_int(add_helper(ctx, &item->elem));
+        emit(buf, EMIT_COMPACT_HELPER, vals);
+    }
+    else {
+        vals[EMIT_SLOT_INDEX] = template_int(add_helper(ctx, &((ast_or_func_t*)func)->elem));
+
+        switch(func->type) {
+            case AST_ZERO_OR_ONE_FUNC:
+                emit(buf, EMIT_COMPACT_OPTIONAL, vals);
+                break;
+            case AST_ZERO_OR_MORE_FUNC:
+                emit(buf, EMIT_COMPACT_REPEAT, vals);
+                break;
+            case AST_ONE_OR_MORE_FUNC:
+                emit(buf, EMIT_COMPACT_MORE, vals);
+                break;
+            default:
+                fatal_error("unknown function in %s: %d", __func__, func->type);
+        }
+    }
+}
+
+/*
+ * The names that C or the structs of the nodes already use.
+ */
+static const char* reserved_names[] = {
+    "alt", "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if", "inline",
+    "int", "long", "register", "restrict", "return", "short", "signed", "sizeof",
+    "static", "struct", "switch", "type", "typedef", "union", "unsigned", "void",
+    "volatile", "while",
+};
+
+/*
+ * The name of the struct and the functions of the node of a rule. The names
+ * that the generic parts of the nodes use get an underscore.
+ */
+static const char* node_name(const char* name) {
+
+    if(!strcmp(name, "node"))
+        return "node_";
+    if(!strcmp(name, "type"))
+        return "type_";
+    return name;
+}
+
+static void emit_part_name(emit_rule_t* ctx, out_buffer_t* buf, int index) {
+
+    add_out_string(buf, "part_");
+    add_out_string(buf, ctx->name);
+    add_out_char(buf, '_');
+    add_out_int(buf, index);
+}
+
+/*
+ * The name of a field without its number. The names are in lower case and
+ * a name that is reserved gets an underscore.
+ */
+static void emit_field_base(out_buffer_t* buf, emit_field_t* field) {
+
+    if(field->base == NULL) {
+        add_out_string(buf, "part_");
+        add_out_int(buf, field->index);
+        return;
+    }
+
+    size_t start = buf->len;
+    for(const char* ch = field->base; *ch != '\0'; ch++)
+        add_out_char(buf, tolower((unsigned char)*ch));
+
+    for(size_t i = 0; i < sizeof(reserved_names) / sizeof(reserved_names[0]); i++) {
+        if(!strcmp(&buf->text[start], reserved_names[i])) {
+            add_out_char(buf, '_');
+            break;
+        }
+    }
+}
+
+static void emit_field_name(out_buffer_t* buf, emit_field_t* field) {
+
+    emit_field_base(buf, field);
+    if(field->num > 1) {
+        add_out_char(buf, '_');
+        add_out_int(buf, field->num);
+    }
+}
+
+/*
+ * The field of an item as the function that stores it sees it. A helper for
+ * a single rule has a pointer to the field.
+ */
+static void emit_field_path(emit_rule_t* ctx, out_buffer_t* buf, emit_item_t* item) {
+
+    if(ctx->slot) {
+        add_out_string(buf, "(*ptr)");
+        return;
+    }
+
+    add_out_string(buf, "ptr->");
+    if(ctx->tagged) {
+        add_out_string(buf, "alt");
+        add_out_int(buf, item->alt + 1);
+        add_out_char(buf, '.');
+    }
+    emit_field_name(buf, &item->field);
+}
+
+static void emit_field_type(emit_rule_t* ctx, out_buffer_t* buf, emit_field_t* field) {
+
+    bool list = (field->kind == FIELD_TERM_LIST || field->kind == FIELD_NTERM_LIST ||
+                 field->kind == FIELD_PART_LIST);
+
+    if(list)
+        add_out_string(buf, "AST_LIST(");
+
+    switch(field->kind) {
+        case FIELD_TERM:
+        case FIELD_TERM_LIST:
+            add_out_string(buf, "token_t*");
+            break;
+        case FIELD_NTERM:
+        case FIELD_NTERM_LIST:
+            add_out_string(buf, "ast_");
+            add_out_string(buf, field->call);
+            add_out_string(buf, "_t*");
+            break;
+        case FIELD_PART:
+        case FIELD_OPTIONAL_PART:
+        case FIELD_PART_LIST:
+            emit_part_name(ctx, buf, field->index);
+            add_out_string(buf, (field->kind == FIELD_OPTIONAL_PART) ? "_t*" : "_t");
+            break;
+    }
+
+    if(list)
+        add_out_char(buf, ')');
+}
+
+/*
+ * A field of terminals is named for its terminal, or is a term when there
+ * is more than one. A field of nodes is named for its rule.
+ */
+static void set_field_base(emit_rule_t* ctx, emit_field_t* field, ast_rule_element_t* elem) {
+
+    ast_node_t* func = get_func(elem);
+
+    if(func != NULL) {
+        pointer_list_t* list = ((ast_group_func_t*)func)->list;
+        if(list->len > 1) {
+            field->base = "term";
+            return;
+        }
+        elem = skip_or(list->list[0]);
+    }
+
+    if(elem->term->type == NON_TERMINAL) {
+        field->base = elem->term->text;
+        field->call = node_name(elem->term->text);
+    }
+    else
+        field->base = find_symbol(ctx->tab, elem->term->text)->decorated;
+}
+
+/*
+ * The field of an item comes from how many times its element can match. A
+ * group and a function over anything but terminals or a single rule have a
+ * helper.
+ */
+static void set_field(emit_rule_t* ctx, emit_item_t* item) {
+
+    ast_node_t* func = get_func(item->elem);
+    emit_field_t* field = &item->field;
+
+    if(func == NULL) {
+        field->kind = is_term(item->elem) ? FIELD_TERM : FIELD_NTERM;
+        set_field_base(ctx, field, item->elem);
+    }
+    else if(func->type == AST_GROUP_FUNC) {
+        if(is_term_set(item->elem)) {
+            field->kind = FIELD_TERM;
+            set_field_base(ctx, field, item->elem);
+        }
+        else {
+            field->kind = FIELD_PART;
+            field->index = add_helper(ctx, &item->elem);
+        }
+    }
+    else {
+        ast_rule_element_t** elem = &((ast_or_func_t*)func)->elem;
+        bool list = (func->type != AST_ZERO_OR_ONE_FUNC);
+
+        if(is_term_set(*elem)) {
+            field->kind = list ? FIELD_TERM_LIST : FIELD_TERM;
+            set_field_base(ctx, field, *elem);
+        }
+        else {
+            field->index = add_helper(ctx, elem);
+            if(ctx->helpers.list[field->index - 1].slot) {
+                field->kind = list ? FIELD_NTERM_LIST : FIELD_NTERM;
+                set_field_base(ctx, field, *elem);
+            }
+            else
+                field->kind = list ? FIELD_PART_LIST : FIELD_OPTIONAL_PART;
+        }
+    }
+}
+
+/*
+ * Find the fields of the items of a typed function. The helpers are added in
+ * the order of the items, so the header and the rule file number them the
+ * same.
+ */
+static void set_fields(emit_rule_t* ctx, emit_item_list_t* items) {
+
+    out_buffer_t* name = create_out_buffer();
+    out_buffer_t* other = create_out_buffer();
+
+    for(int i = 0; i < items->len; i++) {
+        emit_item_t* item = &items->list[i];
+        set_field(ctx, item);
+
+        clear_out_buffer(name);
+        emit_field_base(name, &item->field);
+        item->field.num = 1;
+        for(int j = 0; j < i; j++) {
+            if(items->list[j].alt != item->alt)
+                continue;
+            clear_out_buffer(other);
+            emit_field_base(other, &items->list[j].field);
+            if(!strcmp(name->text, other->text))
+                item->field.num++;
+        }
+    }
+
+    destroy_out_buffer(name);
+    destroy_out_buffer(other);
+}
+
+/*
+ * The type that a typed function stores to and the function that clears
+ * it. The rule is index 0.
+ */
+static void set_target(emit_rule_t* ctx, int index) {
+
+    emit_helper_t* helper = (index > 0) ? &ctx->helpers.list[index - 1] : NULL;
+
+    ctx->index = index;
+    ctx->slot = (helper != NULL && helper->slot);
+    clear_out_buffer(ctx->target);
+    clear_out_buffer(ctx->clear);
+
+    if(ctx->slot) {
+        add_out_string(ctx->target, "ast_");
+        add_out_string(ctx->target, node_name(((ast_rule_element_t*)helper->items[0])->term->text));
+        add_out_string(ctx->target, "_t*");
+    }
+    else if(helper != NULL) {
+        emit_part_name(ctx, ctx->target, index);
+        add_out_string(ctx->target, "_t");
+        add_out_string(ctx->clear, "clear_");
+        emit_part_name(ctx, ctx->clear, index);
+    }
+    else {
+        add_out_string(ctx->clear, "clear_ast_");
+        add_out_string(ctx->clear, ctx->name);
+    }
+
+    ctx->vals[EMIT_SLOT_TARGET] = template_buffer(ctx->target);
+    ctx->vals[EMIT_SLOT_CLEAR] = template_buffer(ctx->clear);
+    ctx->vals[EMIT_SLOT_PART] = template_bool(helper != NULL && !ctx->slot);
+}
+
+/*
+ * Split a typed function into its items and find their fields.
+ */
+static void split_typed_list(emit_rule_t* ctx, emit_helper_t* list, emit_item_list_t* items, int index) {
+
+    split_list(list, items);
+    set_target(ctx, index);
+    ctx->tagged = (items->len > 0 && items->list[items->len - 1].alt > 0);
+    set_fields(ctx, items);
+}
+
+/*
+ * A typed item stores what it matches in its field rather than adding it to
+ * a node, and an alternative that fails clears what it stored.
+ */
+static void emit_typed_item(emit_rule_t* ctx, out_buffer_t* buf, emit_item_list_t* items, int idx) {
+
+    emit_item_t* item = &items->list[idx];
+    int next = (idx + 1 < items->len && items->list[idx + 1].alt == item->alt) ?
+            items->list[idx + 1].state : MATCH_STATE;
+    ast_node_t* func = get_func(item->elem);
+    emit_field_t* field = &item->field;
+    template_value_t* vals = ctx->vals;
+
+    vals[EMIT_SLOT_STATE] = template_int(item->state);
+    vals[EMIT_SLOT_NEXT] = get_state(next);
+    vals[EMIT_SLOT_LIKELY] = template_bool(item->committed);
+    emit(buf, EMIT_CASE, vals);
+
+    if(ctx->tagged && item->first) {
+        vals[EMIT_SLOT_TAG] = template_int(item->alt + 1);
+        emit(buf, EMIT_TYPED_TAG, vals);
+    }
+
+    clear_out_buffer(ctx->field);
+    emit_field_path(ctx, ctx->field, item);
+    vals[EMIT_SLOT_FIELD] = template_buffer(ctx->field);
+    vals[EMIT_SLOT_INDEX] = template_int(field->index);
+    if(field->call != NULL)
+        vals[EMIT_SLOT_CALL] = template_string(field->call);
+
+    if(field->kind == FIELD_TERM || field->kind == FIELD_TERM_LIST) {
+        clear_out_buffer(ctx->cond);
+        emit_term_set(ctx, ctx->cond, (func == NULL || func->type == AST_GROUP_FUNC) ?
+                      item->elem : ((ast_or_func_t*)func)->elem);
+        vals[EMIT_SLOT_COND] = template_buffer(ctx->cond);
+    }
+
+    if(func == NULL || func->type == AST_GROUP_FUNC) {
+        emit(buf, (field->kind == FIELD_TERM) ? EMIT_TYPED_MATCH_TERM :
+                  (field->kind == FIELD_NTERM) ? EMIT_TYPED_CALL_NTERM : EMIT_TYPED_CALL_PART, vals);
+        emit_fail(ctx, buf, items, idx);
+    }
+    else {
+        switch(func->type) {
+            case AST_ZERO_OR_ONE_FUNC:
+                emit(buf, (field->kind == FIELD_TERM) ? EMIT_TYPED_TERM_OPTIONAL :
+                          (field->kind == FIELD_NTERM) ? EMIT_TYPED_CALL_OPTIONAL : EMIT_TYPED_PART_OPTIONAL, vals);
+                break;
+            case AST_ZERO_OR_MORE_FUNC:
+                emit(buf, (field->kind == FIELD_TERM_LIST) ? EMIT_TYPED_TERM_REPEAT :
+                          (field->kind == FIELD_NTERM_LIST) ? EMIT_TYPED_CALL_REPEAT : EMIT_TYPED_PART_REPEAT, vals);
+                break;
+            case AST_ONE_OR_MORE_FUNC:
+                if(field->kind == FIELD_TERM_LIST) {
+                    emit(buf, EMIT_TYPED_TERM_MORE, vals);
+                    emit_fail(ctx, buf, items, idx);
+                    break;
+                }
+                // the first match is required and the loop is not
+                vals[EMIT_SLOT_NEXT] = template_int(item->loop);
+                emit(buf, EMIT_TYPED_CALL_FIRST, vals);
+                emit_fail(ctx, buf, items, idx);
+                emit(buf, EMIT_BREAK, vals);
+                vals[EMIT_SLOT_STATE] = template_int(item->loop);
+                vals[EMIT_SLOT_NEXT] = get_state(next);
+                emit(buf, EMIT_CASE, vals);
+                emit(buf, (field->kind == FIELD_NTERM_LIST) ? EMIT_TYPED_CALL_REPEAT : EMIT_TYPED_PART_REPEAT, vals);
+                break;
+            default:
+                fatal_error("unknown function in %s: %d", __func__, func->type);
+        }
+    }
+
+    emit(buf, EMIT_BREAK, vals);
+}
+
+/*
+ * Free what the field of an item holds. The tokens belong to the scanner.
+ */
+static void emit_field_free(emit_rule_t* ctx, out_buffer_t* buf, emit_item_t* item, int indent) {
+
+    emit_field_t* field = &item->field;
+
+    clear_out_buffer(ctx->field);
+    emit_field_path(ctx, ctx->field, item);
+    const char* path = ctx->field->text;
+
+    switch(field->kind) {
+        case FIELD_TERM:
+            break;
+        case FIELD_NTERM:
+            add_out_indent(buf, indent);
+            add_out_string(buf, "destroy_ast_");
+            add_out_string(buf, field->call);
+            add_out_char(buf, '(');
+            add_out_string(buf, path);
+            add_out_string(buf, ");\n");
+            break;
+        case FIELD_PART:
+            add_out_indent(buf, indent);
+            add_out_string(buf, "clear_");
+            emit_part_name(ctx, buf, field->index);
+            add_out_string(buf, "(&");
+            add_out_string(buf, path);
+            add_out_string(buf, ");\n");
+            break;
+        case FIELD_OPTIONAL_PART:
+            add_out_indent(buf, indent);
+            add_out_string(buf, "if(");
+            add_out_string(buf, path);
+            add_out_string(buf, " != NULL) {\n");
+            add_out_indent(buf, indent + 4);
+            add_out_string(buf, "clear_");
+            emit_part_name(ctx, buf, field->index);
+            add_out_char(buf, '(');
+            add_out_string(buf, path);
+            add_out_string(buf, ");\n");
+            add_out_indent(buf, indent + 4);
+            add_out_string(buf, "free(");
+            add_out_string(buf, path);
+            add_out_string(buf, ");\n");
+            add_out_indent(buf, indent);
+            add_out_string(buf, "}\n");
+            break;
+        case FIELD_NTERM_LIST:
+        case FIELD_PART_LIST:
+            add_out_indent(buf, indent);
+            add_out_string(buf, "for(int i = 0; i < ");
+            add_out_string(buf, path);
+            add_out_string(buf, ".len; i++)\n");
+            add_out_indent(buf, indent + 4);
+            if(field->kind == FIELD_NTERM_LIST) {
+                add_out_string(buf, "destroy_ast_");
+                add_out_string(buf, field->call);
+                add_out_string(buf, "(AST_ITEM(");
+            }
+            else {
+                add_out_string(buf, "clear_");
+                emit_part_name(ctx, buf, field->index);
+                add_out_string(buf, "(&AST_ITEM(");
+            }
+            add_out_string(buf, path);
+            add_out_string(buf, ", i));\n");
+            // fall through
+        case FIELD_TERM_LIST:
+            add_out_indent(buf, indent);
+            add_out_string(buf, "FREE_AST_LIST(");
+            add_out_string(buf, path);
+            add_out_string(buf, ");\n");
+            break;
+    }
+}
+
+/*
+ * The function that clears the struct of a typed function. Only the fields
+ * of the alternative that is in the struct are freed.
+ */
+static void emit_typed_clear(emit_rule_t* ctx, out_buffer_t* buf, emit_item_list_t* items) {
+
+    out_buffer_t* body = create_out_buffer();
+    out_buffer_t* alt = create_out_buffer();
+
+    for(int i = 0; i < items->len; i++) {
+        emit_item_t* item = &items->list[i];
+        emit_field_free(ctx, alt, item, ctx->tagged ? 12 : 4);
+
+        if((i + 1 < items->len && items->list[i + 1].alt == item->alt) || alt->len == 0)
+            continue;
+
+        if(ctx->tagged) {
+            add_out_string(body, "        case ");
+            add_out_int(body, item->alt + 1);
+            add_out_string(body, ":\n");
+            add_out_text(body, alt->text, alt->len);
+            add_out_string(body, "            break;\n");
+        }
+        else
+            add_out_text(body, alt->text, alt->len);
+        clear_out_buffer(alt);
+    }
+
+    clear_out_buffer(alt);
+    if(body->len > 0) {
+        if(ctx->tagged) {
+            add_out_string(alt, "    switch(ptr->alt) {\n");
+            add_out_text(alt, body->text, body->len);
+            add_out_string(alt, "    }\n");
+        }
+        else
+            add_out_text(alt, body->text, body->len);
+        add_out_char(alt, '\n');
+    }
+
+    ctx->vals[EMIT_SLOT_BODY] = template_buffer(alt);
+    emit(buf, EMIT_TYPED_CLEAR, ctx->vals);
+
+    destroy_out_buffer(body);
+    destroy_out_buffer(alt);
+}
+
+/*
+ * The struct of a typed function, for the header. Every field is a pointer
+ * or made of pointers, so the fields have no padding between them, and the
+ * tag of the alternative shares a word with the type of the node.
+ */
+static void emit_typed_struct(emit_rule_t* ctx, out_buffer_t* buf, emit_item_list_t* items) {
+
+    if(ctx->index == 0) {
+        add_out_string(buf, "struct _ast_");
+        add_out_string(buf, ctx->name);
+        add_out_string(buf, "_t_ {\n");
+        add_out_string(buf, "    ast_type_t type;\n");
+    }
+    else
+        add_out_string(buf, "typedef struct {\n");
+
+    if(ctx->tagged)
+        add_out_string(buf, "    int alt;\n    union {\n");
+
+    for(int i = 0; i < items->len; i++) {
+        emit_item_t* item = &items->list[i];
+
+        if(ctx->tagged && item->first)
+            add_out_string(buf, "        struct {\n");
+
+        add_out_indent(buf, ctx->tagged ? 12 : 4);
+        emit_field_type(ctx, buf, &item->field);
+        add_out_char(buf, ' ');
+        emit_field_name(buf, &item->field);
+        add_out_string(buf, ";\n");
+
+        if(ctx->tagged && (i + 1 == items->len || items->list[i + 1].alt != item->alt)) {
+            add_out_string(buf, "        } alt");
+            add_out_int(buf, item->alt + 1);
+            add_out_string(buf, ";\n");
+        }
+    }
+
+    if(ctx->tagged)
+        add_out_string(buf, "    };\n");
+
+    if(ctx->index == 0)
+        add_out_string(buf, "};\n");
+    else {
+        add_out_string(buf, "} ");
+        emit_part_name(ctx, buf, ctx->index);
+        add_out_string(buf, "_t;\n");
+    }
+}
+
+/*
+ * Render a list as a typed function and the function that clears what it
+ * stores. A helper for a single rule has nothing of its own to clear, and
+ * the rule also has the function that frees its node.
+ */
+static void emit_typed_list(emit_rule_t* ctx, out_buffer_t* buf, emit_helper_t* list, int index) {
+
+    emit_item_list_t items;
+    init_emit_item_list(&items);
+    split_typed_list(ctx, list, &items, index);
+
+    clear_out_buffer(ctx->body);
+    for(int i = 0; i < items.len; i++)
+        emit_typed_item(ctx, ctx->body, &items, i);
+
+    clear_out_buffer(ctx->comment);
+    emit_comment(ctx->comment, list->node);
+
+    template_value_t* vals = ctx->vals;
+    vals[EMIT_SLOT_COMMENT] = template_buffer(ctx->comment);
+    vals[EMIT_SLOT_BODY] = template_buffer(ctx->body);
+    vals[EMIT_SLOT_INDEX] = template_int(index);
+    vals[EMIT_SLOT_RULE] = template_bool(index == 0);
+    vals[EMIT_SLOT_HELPER] = template_bool(index > 0);
+    emit(buf, EMIT_TYPED_FUNC, vals);
+
+    if(!ctx->slot) {
+        add_out_char(buf, '\n');
+        emit_typed_clear(ctx, buf, &items);
+    }
+
+    if(index == 0) {
+        add_out_char(buf, '\n');
+        emit(buf, EMIT_TYPED_DESTROY, vals);
+    }
+
+    uninit_emit_item_list(&items);
+}
+
+/*
+ * Render a list as a function. Index 0 is the rule itself, which makes the
+ * node and returns it. The helpers add to the node of the rule and return
+ * whether they matched.
+ */
+static void emit_list(emit_rule_t* ctx, out_buffer_t* buf, emit_helper_t* list, int index) {
+
+    if(ctx->typed) {
+        emit_typed_list(ctx, buf, list, index);
+        return;
+    }
+
+    emit_item_list_t items;
+    init_emit_item_list(&items);
+    split_list(list, &items);
+
+    ctx->nterm = false;
+    ctx->mark = (index > 0);
+    clear_out_buffer(ctx->body);
+    for(int i = 0; i < items.len; i++) {
+        if(ctx->compact)
+            emit_compact_item(ctx, ctx->body, &items, i);
+        else
+            emit_item(ctx, ctx->body, &items, i);
+    }
+
+    clear_out_buffer(ctx->comment);
+    emit_comment(ctx->comment, list->node);
+
+    template_value_t* vals = ctx->vals;
+    vals[EMIT_SLOT_COMMENT] = template_buffer(ctx->comment);
+    vals[EMIT_SLOT_BODY] = template_buffer(ctx->body);
+    vals[EMIT_SLOT_INDEX] = template_int(index);
+    vals[EMIT_SLOT_RULE] = template_bool(index == 0);
+    vals[EMIT_SLOT_HELPER] = template_bool(index > 0);
+    vals[EMIT_SLOT_NTERM] = template_bool(ctx->nterm);
+    vals[EMIT_SLOT_MARK] = template_bool(ctx->mark);
+    emit(buf, ctx->compact ? EMIT_COMPACT_FUNC : EMIT_FUNC, vals);
+
+    uninit_emit_item_list(&items);
+}
+
+static void init_emit_rule(emit_rule_t* ctx, symbol_table_t* tab, ast_non_terminal_rule_t* rule,
+                           emit_options_t* opts) {
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->tab = tab;
+    ctx->name = opts->typed ? node_name(rule->nterm->text) : rule->nterm->text;
+    ctx->compact = opts->compact;
+    ctx->typed = opts->typed;
+    ctx->upper = create_out_buffer();
+    ctx->body = create_out_buffer();
+    ctx->comment = create_out_buffer();
+    ctx->expected = create_out_buffer();
+    ctx->cond = create_out_buffer();
+    ctx->field = create_out_buffer();
+    ctx->target = create_out_buffer();
+    ctx->clear = create_out_buffer();
+    init_emit_helper_list(&ctx->helpers);
+
+    emit_upper(ctx->upper, rule->nterm->text);
+    ctx->vals[EMIT_SLOT_NAME] = template_string(ctx->name);
+    ctx->vals[EMIT_SLOT_UPPER] = template_buffer(ctx->upper);
+    ctx->vals[EMIT_SLOT_STATIC] = template_bool(opts->amalgamate);
+}
+
+static void uninit_emit_rule(emit_rule_t* ctx) {
+
+    destroy_out_buffer(ctx->upper);
+    destroy_out_buffer(ctx->body);
+    destroy_out_buffer(ctx->comment);
+    destroy_out_buffer(ctx->expected);
+    destroy_out_buffer(ctx->cond);
+    destroy_out_buffer(ctx->field);
+    destroy_out_buffer(ctx->target);
+    destroy_out_buffer(ctx->clear);
+    uninit_emit_helper_list(&ctx->helpers);
+}
+
+/*
+ * Render the C file for a non-terminal rule. The file is the head followed
+ * by the body. The helpers are found while the rule is rendered, so their
+ * prototypes are in the head, which is made last. When the parser is
+ * amalgamated, this is a part of the C file of the parser and the rule is
+ * static.
+ */
+void emit_rule_file(out_buffer_t* head, out_buffer_t* body, symbol_table_t* tab,
+                    ast_non_terminal_rule_t* rule, const char* grammar, emit_options_t* opts) {
+
+    assert(head != NULL);
+    assert(body != NULL);
+    assert(tab != NULL);
+    assert(rule != NULL);
+    assert(opts != NULL);
+
+    pthread_once(&templates_once, compile_templates);
+
+    emit_rule_t ctx;
+    init_emit_rule(&ctx, tab, rule, opts);
+    ctx.vals[EMIT_SLOT_GRAMMAR] = template_string(grammar);
+
+    pointer_list_t* elems = get_rule_elems(rule);
+    emit_helper_t list = { (ast_node_t*)rule, elems->list, elems->len, false };
+
+    emit_list(&ctx, body, &list, 0);
+    for(int i = 0; i < ctx.helpers.len; i++) {
+        emit_helper_t helper = ctx.helpers.list[i];
+        add_out_char(body, '\n');
+        emit_list(&ctx, body, &helper, i + 1);
+    }
+
+    if(opts->amalgamate)
+        add_out_char(head, '\n');
+    else
+        emit(head, EMIT_FILE_HEAD, ctx.vals);
+
+    if(ctx.typed) {
+        // the rule also has a prototype for the function that clears it
+        for(int i = 0; i <= ctx.helpers.len; i++) {
+            set_target(&ctx, i);
+            ctx.vals[EMIT_SLOT_INDEX] = template_int(i);
+            ctx.vals[EMIT_SLOT_RULE] = template_bool(i == 0);
+            ctx.vals[EMIT_SLOT_HELPER] = template_bool(i > 0);
+            emit(head, EMIT_TYPED_PROTO, ctx.vals);
+        }
+        add_out_char(head, '\n');
+    }
+    else {
+        for(int i = 0; i < ctx.helpers.len; i++) {
+            ctx.vals[EMIT_SLOT_INDEX] = template_int(i + 1);
+            emit(head, EMIT_PROTO, ctx.vals);
+        }
+        if(ctx.helpers.len > 0)
+            add_out_char(head, '\n');
+    }
+
+    uninit_emit_rule(&ctx);
+}
+
+/*
+ * The structs of a rule and of its groups. They are found in the same order
+ * as when the rule is rendered, and a group is in the struct that has it, so
+ * the structs are written from the last one to the rule.
+ */
+static void emit_rule_types(out_buffer_t* buf, symbol_table_t* tab, ast_non_terminal_rule_t* rule,
+                            emit_options_t* opts) {
+
+    emit_rule_t ctx;
+    init_emit_rule(&ctx, tab, rule, opts);
+
+    pointer_list_t structs;
+    init_pointer_list(&structs);
+
+    pointer_list_t* elems = get_rule_elems(rule);
+    emit_helper_t list = { (ast_node_t*)rule, elems->list, elems->len, false };
+
+    for(int i = 0; i <= ctx.helpers.len; i++) {
+        emit_helper_t helper = (i == 0) ? list : ctx.helpers.list[i - 1];
+        emit_item_list_t items;
+        init_emit_item_list(&items);
+        split_typed_list(&ctx, &helper, &items, i);
+
+        if(!ctx.slot) {
+            out_buffer_t* text = create_out_buffer();
+            emit_typed_struct(&ctx, text, &items);
+            add_pointer_list(&structs, text);
+        }
+
+        uninit_emit_item_list(&items);
+    }
+
+    for(int i = structs.len - 1; i >= 0; i--) {
+        out_buffer_t* text = structs.list[i];
+        add_out_text(buf, text->text, text->len);
+        add_out_char(buf, '\n');
+        destroy_out_buffer(text);
+    }
+
+    uninit_pointer_list(&structs);
+    uninit_emit_rule(&ctx);
+}
+
+static int compare_names(const void* left, const void* right) {
+
+    return strcmp((*(symbol_t**)left)->name, (*(symbol_t**)right)->name);
+}
+
+static int compare_decorated(const void* left, const void* right) {
+
+    return strcmp((*(symbol_t**)left)->decorated, (*(symbol_t**)right)->decorated);
+}
+
+/*
+ * A copy of a list of symbols in sorted order. The ids are in the order that
+ * the symbols are first seen, which a new reference to a symbol can change,
+ * so the header is written in this order to only change with the symbols.
+ */
+static pointer_list_t* sort_symbols(pointer_list_t* list, int (*compare)(const void*, const void*)) {
+
+    pointer_list_t* sorted = create_pointer_list();
+    int post = 0;
+    void* sym;
+
+    while(NULL != (sym = iterate_pointer_list(list, &post)))
+        add_pointer_list(sorted, sym);
+    qsort(sorted->list, sorted->len, sizeof(void*), compare);
+
+    return sorted;
+}
+
+/*
+ * The nodes of a typed parser. The names of the structs of the rules are
+ * declared first, so the structs can point to each other in any order.
+ */
+static void emit_typed_nodes(out_buffer_t* buf, symbol_table_t* tab, emit_options_t* opts) {
+
+    int post = 0;
+    symbol_t* sym;
+    template_value_t vals[EMIT_NUM_SLOTS] = { 0 };
+    out_buffer_t* body = create_out_buffer();
+    pointer_list_t* nterms = sort_symbols(tab->nterms, compare_names);
+
+    while(NULL != (sym = iterate_pointer_list(nterms, &post))) {
+        add_out_string(body, "typedef struct _ast_");
+        add_out_string(body, node_name(sym->name));
+        add_out_string(body, "_t_ ast_");
+        add_out_string(body, node_name(sym->name));
+        add_out_string(body, "_t;\n");
+    }
+    add_out_char(body, '\n');
+
+    post = 0;
+    while(NULL != (sym = iterate_pointer_list(nterms, &post)))
+        emit_rule_types(body, tab, (ast_non_terminal_rule_t*)sym->def, opts);
+
+    vals[EMIT_SLOT_BODY] = template_buffer(body);
+    emit(buf, EMIT_TYPED_NODES, vals);
+
+    destroy_pointer_list(nterms);
+    destroy_out_buffer(body);
+}
+
+/*
+ * The types that the header of both layouts has. Different terminals can be
+ * decorated with the same name, so the names are checked against a table of
+ * the names that were already written.
+ */
+static void emit_decls(out_buffer_t* buf, symbol_table_t* tab, emit_options_t* opts) {
+
+    int post;
+    symbol_t* sym;
+    template_value_t vals[EMIT_NUM_SLOTS] = { 0 };
+    out_buffer_t* tokens = create_out_buffer();
+    out_buffer_t* types = create_out_buffer();
+    out_buffer_t* upper = create_out_buffer();
+    out_buffer_t* nodes = create_out_buffer();
+
+    pointer_list_t* terms = sort_symbols(tab->terms, compare_decorated);
+    pointer_list_t* nterms = sort_symbols(tab->nterms, compare_names);
+
+    symbol_table_t* names = create_symbol_table();
+    token_t tok = { TERMINAL_SYMBOL, "END_OF_INPUT", NULL, 0, 0, 0 };
+    intern_symbol(names, &tok);
+
+    post = 0;
+    while(NULL != (sym = iterate_pointer_list(terms, &post))) {
+        size_t len = names->len;
+        tok.text = sym->decorated;
+        intern_symbol(names, &tok);
+        if(names->len > len) {
+            vals[EMIT_SLOT_TERM] = template_string(sym->decorated);
+            emit(tokens, EMIT_TOKEN, vals);
+        }
+    }
+    destroy_symbol_table(names);
+
+    post = 0;
+    while(NULL != (sym = iterate_pointer_list(nterms, &post))) {
+        clear_out_buffer(upper);
+        emit_upper(upper, sym->name);
+        vals[EMIT_SLOT_UPPER] = template_buffer(upper);
+        emit(types, EMIT_TYPE, vals);
+    }
+
+    if(opts->typed)
+        emit_typed_nodes(nodes, tab, opts);
+    else
+        emit(nodes, EMIT_NODES, vals);
+
+    vals[EMIT_SLOT_TOKENS] = template_buffer(tokens);
+    vals[EMIT_SLOT_TYPES] = template_buffer(types);
+    vals[EMIT_SLOT_NODES] = template_buffer(nodes);
+    emit(buf, EMIT_DECLS, vals);
+
+    destroy_pointer_list(terms);
+    destroy_pointer_list(nterms);
+    destroy_out_buffer(tokens);
+    destroy_out_buffer(types);
+    destroy_out_buffer(upper);
+    destroy_out_buffer(nodes);
+}
+
+static void emit_rule_protos(out_buffer_t* buf, symbol_table_t* tab, bool is_static) {
+
+    int post = 0;
+    symbol_t* sym;
+    template_value_t vals[EMIT_NUM_SLOTS] = { 0 };
+    pointer_list_t* nterms = sort_symbols(tab->nterms, compare_names);
+
+    vals[EMIT_SLOT_STATIC] = template_bool(is_static);
+    while(NULL != (sym = iterate_pointer_list(nterms, &post))) {
+        vals[EMIT_SLOT_NAME] = template_string(sym->name);
+        emit(buf, EMIT_RULE_PROTO, vals);
+    }
+
+    destroy_pointer_list(nterms);
+}
+
+/*
+ * The rules of a typed parser and the function that frees any node, which
+ * calls the function of the rule of the node.
+ */
+static void emit_typed_protos(out_buffer_t* buf, symbol_table_t* tab) {
+
+    int post = 0;
+    symbol_t* sym;
+    template_value_t vals[EMIT_NUM_SLOTS] = { 0 };
+    out_buffer_t* upper = create_out_buffer();
+    out_buffer_t* cases = create_out_buffer();
+
+    while(NULL != (sym = iterate_pointer_list(tab->nterms, &post))) {
+        clear_out_buffer(upper);
+        emit_upper(upper, sym->name);
+        vals[EMIT_SLOT_NAME] = template_string(node_name(sym->name));
+        vals[EMIT_SLOT_UPPER] = template_buffer(upper);
+        emit(buf, EMIT_TYPED_RULE_PROTO, vals);
+        emit(cases, EMIT_TYPED_DESTROY_CASE, vals);
+    }
+
+    add_out_char(buf, '\n');
+    vals[EMIT_SLOT_BODY] = template_buffer(cases);
+    emit(buf, EMIT_TYPED_DESTROY_NODE, vals);
+
+    destroy_out_buffer(upper);
+    destroy_out_buffer(cases);
+}
+
+/*
+ * Render the header that all of the rules share. The header of an
+ * amalgamated parser only has the types and the functions that the program
+ * uses.
+ */
+void emit_header_file(out_buffer_t* buf, symbol_table_t* tab, const char* grammar, emit_options_t* opts) {
+
+    assert(buf != NULL);
+    assert(tab != NULL);
+    assert(opts != NULL);
+
+    pthread_once(&templates_once, compile_templates);
+
+    template_value_t vals[EMIT_NUM_SLOTS] = { 0 };
+    out_buffer_t* decls = create_out_buffer();
+    out_buffer_t* rules = create_out_buffer();
+    out_buffer_t* macros = create_out_buffer();
+    out_buffer_t* runtime = create_out_buffer();
+
+    emit_decls(decls, tab, opts);
+    vals[EMIT_SLOT_GRAMMAR] = template_string(grammar);
+    vals[EMIT_SLOT_DECLS] = template_buffer(decls);
+
+    if(opts->amalgamate)
+        emit(buf, EMIT_AMALG_HEADER, vals);
+    else {
+        emit_rule_protos(rules, tab, false);
+        emit(macros, EMIT_MACROS, vals);
+        if(opts->compact) {
+            emit(runtime, EMIT_COMPACT_TYPES, vals);
+            emit(runtime, EMIT_COMPACT_PROTOS, vals);
+        }
+        vals[EMIT_SLOT_RULES] = template_buffer(rules);
+        vals[EMIT_SLOT_MACROS] = template_buffer(macros);
+        vals[EMIT_SLOT_RUNTIME] = template_buffer(runtime);
+        emit(buf, EMIT_HEADER, vals);
+    }
+
+    destroy_out_buffer(decls);
+    destroy_out_buffer(rules);
+    destroy_out_buffer(macros);
+    destroy_out_buffer(runtime);
+}
+
+/*
+ * Render the runtime of a parser that is not amalgamated. It has the token
+ * queue, the errors, the AST code and the entry point, and the shared code
+ * of the rules when the parser is compact.
+ */
+void emit_runtime_file(out_buffer_t* buf, symbol_table_t* tab, const char* grammar, emit_options_t* opts) {
+
+    assert(buf != NULL);
+    assert(tab != NULL);
+    assert(opts != NULL);
+
+    pthread_once(&templates_once, compile_templates);
+
+    template_value_t vals[EMIT_NUM_SLOTS] = { 0 };
+    out_buffer_t* queue = create_out_buffer();
+    out_buffer_t* ast = create_out_buffer();
+    out_buffer_t* runtime = create_out_buffer();
+    out_buffer_t* entry = create_out_buffer();
+    symbol_t* start = index_pointer_list(tab->nterms, 0);
+
+    vals[EMIT_SLOT_STATIC] = template_bool(false);
+    emit(queue, EMIT_QUEUE, vals);
+    emit(ast, EMIT_AST, vals);
+    if(opts->compact)
+        emit(runtime, EMIT_COMPACT_RUNTIME, vals);
+
+    vals[EMIT_SLOT_START] = template_string(start->name);
+    vals[EMIT_SLOT_NAME] = template_string(start->name);
+    emit(entry, EMIT_ENTRY, vals);
+
+    vals[EMIT_SLOT_GRAMMAR] = template_string(grammar);
+    vals[EMIT_SLOT_QUEUE] = template_buffer(queue);
+    vals[EMIT_SLOT_AST] = template_buffer(ast);
+    vals[EMIT_SLOT_RUNTIME] = template_buffer(runtime);
+    vals[EMIT_SLOT_ENTRY] = template_buffer(entry);
+    emit(buf, EMIT_RUNTIME_SOURCE, vals);
+
+    destroy_out_buffer(queue);
+    destroy_out_buffer(ast);
+    destroy_out_buffer(runtime);
+    destroy_out_buffer(entry);
+}
+
+/*
+ * Render the start of an amalgamated parser. It has the token queue, the
+ * errors and the AST code that the rules use, and the entry point, which
+ * parses the first rule of the grammar. The rules follow it. The AST code
+ * of a typed parser frees a node by its type.
+ */
+void emit_source_file(out_buffer_t* buf, symbol_table_t* tab, const char* grammar, emit_options_t* opts) {
+
+    assert(buf != NULL);
+    assert(tab != NULL);
+    assert(opts != NULL);
+
+    pthread_once(&templates_once, compile_templates);
+
+    template_value_t vals[EMIT_NUM_SLOTS] = { 0 };
+    out_buffer_t* rules = create_out_buffer();
+    out_buffer_t* macros = create_out_buffer();
+    out_buffer_t* runtime = create_out_buffer();
+    out_buffer_t* ast = create_out_buffer();
+    out_buffer_t* queue = create_out_buffer();
+    out_buffer_t* entry = create_out_buffer();
+    symbol_t* start = index_pointer_list(tab->nterms, 0);
+
+    vals[EMIT_SLOT_STATIC] = template_bool(true);
+    emit(queue, EMIT_QUEUE, vals);
+    if(opts->typed) {
+        emit_typed_protos(rules, tab);
+        emit(ast, EMIT_TYPED_AST, vals);
+    }
+    else {
+        emit_rule_protos(rules, tab, true);
+        emit(ast, EMIT_AST, vals);
+    }
+    emit(macros, EMIT_MACROS, vals);
+    if(opts->compact) {
+        emit(runtime, EMIT_COMPACT_TYPES, vals);
+        emit(runtime, EMIT_COMPACT_RUNTIME, vals);
+    }
+
+    vals[EMIT_SLOT_START] = template_string(opts->typed ? node_name(start->name) : start->name);
+    vals[EMIT_SLOT_NAME] = template_string(start->name);
+    vals[EMIT_SLOT_TYPED] = template_bool(opts->typed);
+    emit(entry, EMIT_ENTRY, vals);
+
+    vals[EMIT_SLOT_GRAMMAR] = template_string(grammar);
+    vals[EMIT_SLOT_RULES] = template_buffer(rules);
+    vals[EMIT_SLOT_MACROS] = template_buffer(macros);
+    vals[EMIT_SLOT_RUNTIME] = template_buffer(runtime);
+    vals[EMIT_SLOT_QUEUE] = template_buffer(queue);
+    vals[EMIT_SLOT_AST] = template_buffer(ast);
+    vals[EMIT_SLOT_ENTRY] = template_buffer(entry);
+    emit(buf, EMIT_AMALG_SOURCE, vals);
+
+    destroy_out_buffer(rules);
+    destroy_out_buffer(macros);
+    destroy_out_buffer(runtime);
+    destroy_out_buffer(ast);
+    destroy_out_buffer(queue);
+    destroy_out_buffer(entry);
+}
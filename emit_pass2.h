@@ -1,5 +1,15 @@
 #ifndef _EMIT_PASS2_H_
 #define _EMIT_PASS2_H_
 
+#include "ast.h"
+#include "emit.h"
+#include "emit_pass1.h"
+#include "out_buffer.h"
+
+void emit_rule_file(out_buffer_t* head, out_buffer_t* body, symbol_table_t* tab,
+                    ast_non_terminal_rule_t* rule, const char* grammar, emit_options_t* opts);
+void emit_header_file(out_buffer_t* buf, symbol_table_t* tab, const char* grammar, emit_options_t* opts);
+void emit_source_file(out_buffer_t* buf, symbol_table_t* tab, const char* grammar, emit_options_t* opts);
+void emit_runtime_file(out_buffer_t* buf, symbol_table_t* tab, const char* grammar, emit_options_t* opts);
 
 #endif /* _EMIT_PASS2_H_ */
@@ -0,0 +1,1128 @@
+/*
+ * The templates of the C backend. Each rule becomes a state machine like
+ * the ones in parser.c. The templates are compiled when they are first
+ * used, see template.h for the syntax.
+ *
+ * The parser is a C file for every rule, parser_rt.c with the token queue,
+ * the AST code and the entry point, and a header, or one C file and a
+ * header when it is amalgamated. A compact parser has the same layout, but
+ * its rules are calls to shared code in place of the state machines, and
+ * the shared code is in parser_rt.c as well when it is not amalgamated. The
+ * helpers of a rule are named match_ so that they cannot be the same as the
+ * parse_ function of another rule.
+ *
+ * A typed parser is always amalgamated. It has its own AST code, and its
+ * state machines store into the struct of the rule or of the group.
+ */
+#include "emit_templates.h"
+
+const char* emit_slots[EMIT_NUM_SLOTS] = {
+    [EMIT_SLOT_GRAMMAR] = "grammar",
+    [EMIT_SLOT_NAME] = "name",
+    [EMIT_SLOT_UPPER] = "upper",
+    [EMIT_SLOT_INDEX] = "index",
+    [EMIT_SLOT_STATE] = "state",
+    [EMIT_SLOT_NEXT] = "next",
+    [EMIT_SLOT_ALT] = "alt",
+    [EMIT_SLOT_CALL] = "call",
+    [EMIT_SLOT_TERM] = "term",
+    [EMIT_SLOT_EXPECTED] = "expected",
+    [EMIT_SLOT_COMMENT] = "comment",
+    [EMIT_SLOT_BODY] = "body",
+    [EMIT_SLOT_RULE] = "rule",
+    [EMIT_SLOT_HELPER] = "helper",
+    [EMIT_SLOT_NTERM] = "nterm",
+    [EMIT_SLOT_MARK] = "mark",
+    [EMIT_SLOT_TOKENS] = "tokens",
+    [EMIT_SLOT_TYPES] = "types",
+    [EMIT_SLOT_RULES] = "rules",
+    [EMIT_SLOT_STATIC] = "static",
+    [EMIT_SLOT_START] = "start",
+    [EMIT_SLOT_DECLS] = "decls",
+    [EMIT_SLOT_MACROS] = "macros",
+    [EMIT_SLOT_LIKELY] = "likely",
+    [EMIT_SLOT_RUNTIME] = "runtime",
+    [EMIT_SLOT_COND] = "cond",
+    [EMIT_SLOT_NODES] = "nodes",
+    [EMIT_SLOT_AST] = "ast",
+    [EMIT_SLOT_TYPED] = "typed",
+    [EMIT_SLOT_FIELD] = "field",
+    [EMIT_SLOT_TARGET] = "target",
+    [EMIT_SLOT_PART] = "part",
+    [EMIT_SLOT_TAG] = "tag",
+    [EMIT_SLOT_CLEAR] = "clear",
+    [EMIT_SLOT_QUEUE] = "queue",
+    [EMIT_SLOT_ENTRY] = "entry",
+};
+
+const char* c_templates[EMIT_NUM_TEMPLATES] = {
+
+    [EMIT_FILE_HEAD] =
+        "/*\n"
+        " * This file was generated by parsgen from ${grammar}. Do not edit.\n"
+        " */\n"
+        "#include \"parser.h\"\n"
+        "\n",
+
+    [EMIT_PROTO] =
+        "static bool match_${name}_${index}(ast_node_t* ptr);\n",
+
+    // a rule makes its node and a helper adds to the node of its rule
+    [EMIT_FUNC] =
+        "${comment}"
+        "${?rule}"
+        "${?static}static ${/static}ast_node_t* parse_${name}(void) {\n"
+        "\n"
+        "    ENTER;\n"
+        "\n"
+        "    ast_node_t* ptr = create_ast_node(AST_${upper});\n"
+        "${/rule}"
+        "${?helper}"
+        "static bool match_${name}_${index}(ast_node_t* ptr) {\n"
+        "\n"
+        "    ENTER;\n"
+        "\n"
+        "    bool result = false;\n"
+        "${/helper}"
+        "${?nterm}"
+        "    ast_node_t* nterm = NULL;\n"
+        "${/nterm}"
+        "\n"
+        "    int state = 100;\n"
+        "    bool finished = false;\n"
+        "\n"
+        "    size_t post = post_token_queue();\n"
+        "${?mark}"
+        "    int mark = ptr->len;\n"
+        "${/mark}"
+        "\n"
+        "    while(!finished) {\n"
+        "        switch(state) {\n"
+        "${body}"
+        "            case MATCH_STATE:\n"
+        "                TRACE;\n"
+        "${?helper}"
+        "                result = true;\n"
+        "${/helper}"
+        "                finished = true;\n"
+        "                break;\n"
+        "\n"
+        "            case NO_MATCH_STATE:\n"
+        "                TRACE;\n"
+        "                reset_token_queue(post);\n"
+        "${?helper}"
+        "                truncate_ast_node(ptr, mark);\n"
+        "${/helper}"
+        "${?rule}"
+        "                destroy_ast_node(ptr);\n"
+        "                ptr = NULL;\n"
+        "${/rule}"
+        "                finished = true;\n"
+        "                break;\n"
+        "\n"
+        "            case ERROR_STATE:\n"
+        "                TRACE;\n"
+        "${?rule}"
+        "                destroy_ast_node(ptr);\n"
+        "                ptr = NULL;\n"
+        "${/rule}"
+        "                finished = true;\n"
+        "                break;\n"
+        "\n"
+        "            default:\n"
+        "                state_error(__func__, state);\n"
+        "        }\n"
+        "    }\n"
+        "\n"
+        "${?rule}"
+        "    RETURN(ptr);\n"
+        "${/rule}"
+        "${?helper}"
+        "    RETURN(result);\n"
+        "${/helper}"
+        "}\n",
+
+    [EMIT_CASE] =
+        "            case ${state}:\n"
+        "                TRACE;\n",
+
+    [EMIT_BREAK] =
+        "                break;\n"
+        "\n",
+
+    // the match of an element is likely when a failure is an error
+    [EMIT_CALL_NTERM] =
+        "                if(${?likely}LIKELY(${/likely}NULL != (nterm = parse_${call}())${?likely})${/likely}) {\n"
+        "                    add_ast_nterm(ptr, nterm);\n"
+        "                    state = ${next};\n"
+        "                }\n",
+
+    [EMIT_MATCH_TERM] =
+        "                if(${?likely}LIKELY(${/likely}TTYPE == ${term}${?likely})${/likely}) {\n"
+        "                    add_ast_term(ptr, consume_token());\n"
+        "                    state = ${next};\n"
+        "                }\n",
+
+    [EMIT_CALL_HELPER] =
+        "                if(${?likely}LIKELY(${/likely}match_${name}_${index}(ptr)${?likely})${/likely})\n"
+        "                    state = ${next};\n",
+
+    // a function over terminals takes them without a helper
+    [EMIT_TERM_OPTIONAL] =
+        "                if(${cond})\n"
+        "                    add_ast_term(ptr, consume_token());\n"
+        "                state = ${next};\n",
+
+    [EMIT_TERM_REPEAT] =
+        "                while(${cond})\n"
+        "                    add_ast_term(ptr, consume_token());\n"
+        "                state = ${next};\n",
+
+    [EMIT_TERM_MORE] =
+        "                if(${?likely}LIKELY(${/likely}${cond}${?likely})${/likely}) {\n"
+        "                    do\n"
+        "                        add_ast_term(ptr, consume_token());\n"
+        "                    while(${cond});\n"
+        "                    state = ${next};\n"
+        "                }\n",
+
+    [EMIT_CALL_OPTIONAL] =
+        "                match_${name}_${index}(ptr);\n"
+        "                state = ${next};\n",
+
+    [EMIT_CALL_REPEAT] =
+        "                if(!match_${name}_${index}(ptr))\n"
+        "                    state = ${next};\n",
+
+    [EMIT_FAIL_ERROR] =
+        "                else {\n"
+        "                    EXPECTED(${expected});\n"
+        "                    state = ERROR_STATE;\n"
+        "                }\n",
+
+    [EMIT_FAIL_NEXT] =
+        "                else\n"
+        "                    state = ${alt};\n",
+
+    // the optional elements before this one may have matched
+    [EMIT_FAIL_RESET] =
+        "                else {\n"
+        "                    reset_token_queue(post);\n"
+        "                    truncate_ast_node(ptr, mark);\n"
+        "                    state = ${alt};\n"
+        "                }\n",
+
+    [EMIT_HEADER] =
+        "/*\n"
+        " * This file was generated by parsgen from ${grammar}. Do not edit.\n"
+        " */\n"
+        "#ifndef _PARSER_H_\n"
+        "#define _PARSER_H_\n"
+        "\n"
+        "#include <stdbool.h>\n"
+        "#include <stddef.h>\n"
+        "#include <stdio.h>\n"
+        "\n"
+        "${decls}"
+        "/*\n"
+        " * The scanner is provided by the program. It returns the next token of the\n"
+        " * input, and END_OF_INPUT at the end. The tokens are kept in the AST, so\n"
+        " * they must not be freed or changed while the AST is used.\n"
+        " */\n"
+        "token_t* scan_token(void);\n"
+        "\n"
+        "/*\n"
+        " * Parse the input of the scanner from the first rule of the grammar. The\n"
+        " * file name is only used in the errors. Return NULL if it does not parse.\n"
+        " */\n"
+        "ast_node_t* run_parser(const char* file_name);\n"
+        "int get_parser_errors(void);\n"
+        "void destroy_ast_node(ast_node_t* node);\n"
+        "\n"
+        "/*\n"
+        " * The runtime that the rules use, in parser_rt.c.\n"
+        " */\n"
+        "token_t* get_token(void);\n"
+        "token_t* consume_token(void);\n"
+        "size_t post_token_queue(void);\n"
+        "void reset_token_queue(size_t post);\n"
+        "const char* get_file_name(void);\n"
+        "void syntax_error(const char* file, int line, const char* fmt, ...);\n"
+        "void fatal_error(const char* fmt, ...);\n"
+        "ast_node_t* create_ast_node(ast_type_t type);\n"
+        "void add_ast_term(ast_node_t* node, token_t* tok);\n"
+        "void add_ast_nterm(ast_node_t* node, ast_node_t* nterm);\n"
+        "void truncate_ast_node(ast_node_t* node, int len);\n"
+        "\n"
+        "/*\n"
+        " * One for every non-terminal rule.\n"
+        " */\n"
+        "${rules}"
+        "\n"
+        "${macros}"
+        "${runtime}"
+        "#endif /* _PARSER_H_ */\n",
+
+    // the types that the parser and the program that uses it share
+    [EMIT_DECLS] =
+        "typedef enum {\n"
+        "    END_OF_INPUT,\n"
+        "${tokens}"
+        "} token_type_t;\n"
+        "\n"
+        "typedef struct {\n"
+        "    token_type_t type;\n"
+        "    const char* text;\n"
+        "    int line_no;\n"
+        "} token_t;\n"
+        "\n"
+        "typedef enum {\n"
+        "${types}"
+        "} ast_type_t;\n"
+        "\n"
+        "${nodes}",
+
+    [EMIT_NODES] =
+        "/*\n"
+        " * A node has the terminals and the non-terminals that its rule matched in\n"
+        " * the order that they were matched. Only one of term and nterm is set in an\n"
+        " * element.\n"
+        " */\n"
+        "typedef struct _ast_element_t_ {\n"
+        "    token_t* term;\n"
+        "    struct _ast_node_t_* nterm;\n"
+        "} ast_element_t;\n"
+        "\n"
+        "typedef struct _ast_node_t_ {\n"
+        "    ast_type_t type;\n"
+        "    ast_element_t* elems;\n"
+        "    int len;\n"
+        "    int cap;\n"
+        "} ast_node_t;\n"
+        "\n",
+
+    // the macros that the state machines use
+    [EMIT_MACROS] =
+        "#define MATCH_STATE 1000\n"
+        "#define NO_MATCH_STATE 2000\n"
+        "#define ERROR_STATE 3000\n"
+        "\n"
+        "// #define TRACE_PARSER_STATE\n"
+        "\n"
+        "#ifdef TRACE_PARSER_STATE\n"
+        "#define TRACE fprintf(stdout, \"STATE: %s: %d: %s\\n\", __func__, state, get_token()->text)\n"
+        "#define ENTER fprintf(stdout, \"ENTER: %s\\n\", __func__)\n"
+        "#define RETURN(v)                                  \\\n"
+        "    do {                                           \\\n"
+        "        fprintf(stdout, \"RETURN: %s\\n\", __func__); \\\n"
+        "        return (v);                                \\\n"
+        "    } while(false)\n"
+        "#else\n"
+        "#define TRACE\n"
+        "#define ENTER\n"
+        "#define RETURN(v) return (v)\n"
+        "#endif\n"
+        "\n"
+        "#define TTYPE (get_token()->type)\n"
+        "\n"
+        "#ifdef __GNUC__\n"
+        "#define LIKELY(x) __builtin_expect(!!(x), 1)\n"
+        "#define COLD __attribute__((cold, noinline, unused))\n"
+        "#else\n"
+        "#define LIKELY(x) (x)\n"
+        "#define COLD\n"
+        "#endif\n"
+        "\n"
+        "/*\n"
+        " * The errors are reported out of line, so that the code of the rules only\n"
+        " * has the calls.\n"
+        " */\n"
+        "static COLD void expected_error(const char* what) {\n"
+        "\n"
+        "    syntax_error(get_file_name(), get_token()->line_no,\n"
+        "                 \"expected %s but got \\\"%s\\\"\", what, get_token()->text);\n"
+        "}\n"
+        "\n"
+        "static COLD void state_error(const char* func, int state) {\n"
+        "\n"
+        "    fatal_error(\"unknown state in %s: %d\\n\", func, state);\n"
+        "}\n"
+        "\n"
+        "#define EXPECTED(what) expected_error(what)\n"
+        "\n",
+
+    // the header of an amalgamated parser only has what the program uses
+    [EMIT_AMALG_HEADER] =
+        "/*\n"
+        " * This file was generated by parsgen from ${grammar}. Do not edit.\n"
+        " */\n"
+        "#ifndef _PARSER_H_\n"
+        "#define _PARSER_H_\n"
+        "\n"
+        "#include <stdbool.h>\n"
+        "#include <stddef.h>\n"
+        "\n"
+        "${decls}"
+        "/*\n"
+        " * The scanner is provided by the program. It returns the next token of the\n"
+        " * input, and END_OF_INPUT at the end. The tokens are kept in the AST, so\n"
+        " * they must not be freed or changed while the AST is used.\n"
+        " */\n"
+        "token_t* scan_token(void);\n"
+        "\n"
+        "/*\n"
+        " * Parse the input of the scanner from the first rule of the grammar. The\n"
+        " * file name is only used in the errors. Return NULL if it does not parse.\n"
+        " */\n"
+        "ast_node_t* run_parser(const char* file_name);\n"
+        "int get_parser_errors(void);\n"
+        "void destroy_ast_node(ast_node_t* node);\n"
+        "\n"
+        "#endif /* _PARSER_H_ */\n",
+
+    // an amalgamated parser has the runtime and the rules in one file
+    [EMIT_AMALG_SOURCE] =
+        "/*\n"
+        " * This file was generated by parsgen from ${grammar}. Do not edit.\n"
+        " */\n"
+        "#include <stdarg.h>\n"
+        "#include <stdio.h>\n"
+        "#include <stdlib.h>\n"
+        "#include <string.h>\n"
+        "\n"
+        "#include \"parser.h\"\n"
+        "\n"
+        "${queue}"
+        "${ast}"
+        "${macros}"
+        "${runtime}"
+        "${rules}"
+        "\n"
+        "${entry}",
+
+    // the runtime of a parser that is not amalgamated, which is compiled on
+    // its own and linked with the rules
+    [EMIT_RUNTIME_SOURCE] =
+        "/*\n"
+        " * This file was generated by parsgen from ${grammar}. Do not edit.\n"
+        " */\n"
+        "#include <stdarg.h>\n"
+        "#include <stdio.h>\n"
+        "#include <stdlib.h>\n"
+        "#include <string.h>\n"
+        "\n"
+        "#include \"parser.h\"\n"
+        "\n"
+        "${queue}"
+        "${ast}"
+        "${runtime}"
+        "${entry}",
+
+    // the token queue and the errors, which are static when they are in the
+    // same file as the rules
+    [EMIT_QUEUE] =
+        "/*\n"
+        " * All of the memory of the parser comes from these, so a program can give\n"
+        " * it its own allocator by defining them when it compiles this file. They\n"
+        " * return NULL on failure like the functions of libc.\n"
+        " */\n"
+        "#ifndef PARSER_MALLOC\n"
+        "#define PARSER_MALLOC(size) malloc(size)\n"
+        "#endif\n"
+        "#ifndef PARSER_REALLOC\n"
+        "#define PARSER_REALLOC(ptr, size) realloc((ptr), (size))\n"
+        "#endif\n"
+        "#ifndef PARSER_FREE\n"
+        "#define PARSER_FREE(ptr) free(ptr)\n"
+        "#endif\n"
+        "\n"
+        "/*\n"
+        " * The tokens are read from the scanner when the parser gets to them and\n"
+        " * are kept until the parse is finished, so the parser can go back to any\n"
+        " * of them.\n"
+        " */\n"
+        "static token_t** tokens = NULL;\n"
+        "static size_t num_tokens = 0;\n"
+        "static size_t cap_tokens = 0;\n"
+        "static size_t crnt_token = 0;\n"
+        "static const char* file_name = NULL;\n"
+        "static int errors = 0;\n"
+        "\n"
+        "${?static}static ${/static}void fatal_error(const char* fmt, ...) {\n"
+        "\n"
+        "    va_list args;\n"
+        "\n"
+        "    fprintf(stderr, \"FATAL ERROR: \");\n"
+        "    va_start(args, fmt);\n"
+        "    vfprintf(stderr, fmt, args);\n"
+        "    va_end(args);\n"
+        "    exit(1);\n"
+        "}\n"
+        "\n"
+        "${?static}static inline ${/static}void syntax_error(const char* file, int line, const char* fmt, ...) {\n"
+        "\n"
+        "    va_list args;\n"
+        "\n"
+        "    fprintf(stderr, \"SYNTAX ERROR: %s: %d: \", file, line);\n"
+        "    va_start(args, fmt);\n"
+        "    vfprintf(stderr, fmt, args);\n"
+        "    va_end(args);\n"
+        "    fputc('\\n', stderr);\n"
+        "    errors++;\n"
+        "}\n"
+        "\n"
+        "${?static}static inline ${/static}const char* get_file_name(void) {\n"
+        "\n"
+        "    return file_name;\n"
+        "}\n"
+        "\n"
+        "static void read_token(void) {\n"
+        "\n"
+        "    if(num_tokens == cap_tokens) {\n"
+        "        cap_tokens = (cap_tokens == 0) ? 1024 : cap_tokens * 2;\n"
+        "        tokens = PARSER_REALLOC(tokens, sizeof(token_t*) * cap_tokens);\n"
+        "        if(tokens == NULL)\n"
+        "            fatal_error(\"cannot allocate %zu tokens\\n\", cap_tokens);\n"
+        "    }\n"
+        "\n"
+        "    tokens[num_tokens++] = scan_token();\n"
+        "}\n"
+        "\n"
+        "${?static}static inline ${/static}token_t* get_token(void) {\n"
+        "\n"
+        "    if(crnt_token == num_tokens)\n"
+        "        read_token();\n"
+        "\n"
+        "    return tokens[crnt_token];\n"
+        "}\n"
+        "\n"
+        "// the end of the input is never consumed\n"
+        "${?static}static inline ${/static}token_t* consume_token(void) {\n"
+        "\n"
+        "    token_t* tok = get_token();\n"
+        "    if(tok->type != END_OF_INPUT)\n"
+        "        crnt_token++;\n"
+        "\n"
+        "    return tok;\n"
+        "}\n"
+        "\n"
+        "${?static}static inline ${/static}size_t post_token_queue(void) {\n"
+        "\n"
+        "    return crnt_token;\n"
+        "}\n"
+        "\n"
+        "${?static}static inline ${/static}void reset_token_queue(size_t post) {\n"
+        "\n"
+        "    crnt_token = post;\n"
+        "}\n"
+        "\n",
+
+    // the entry point
+    [EMIT_ENTRY] =
+        "ast_node_t* run_parser(const char* name) {\n"
+        "\n"
+        "    file_name = name;\n"
+        "    num_tokens = 0;\n"
+        "    crnt_token = 0;\n"
+        "    errors = 0;\n"
+        "\n"
+        "    ast_node_t* ptr = ${?typed}(ast_node_t*)${/typed}parse_${start}();\n"
+        "    if(ptr == NULL && errors == 0)\n"
+        "        syntax_error(file_name, get_token()->line_no,\n"
+        "                     \"expected ${name} but got \\\"%s\\\"\", get_token()->text);\n"
+        "    if(errors != 0) {\n"
+        "        destroy_ast_node(ptr);\n"
+        "        ptr = NULL;\n"
+        "    }\n"
+        "\n"
+        "    PARSER_FREE(tokens);\n"
+        "    tokens = NULL;\n"
+        "    cap_tokens = 0;\n"
+        "\n"
+        "    return ptr;\n"
+        "}\n"
+        "\n"
+        "int get_parser_errors(void) {\n"
+        "\n"
+        "    return errors;\n"
+        "}\n",
+
+    // the AST code of the generic parser
+    [EMIT_AST] =
+        "${?static}static ${/static}ast_node_t* create_ast_node(ast_type_t type) {\n"
+        "\n"
+        "    ast_node_t* node = PARSER_MALLOC(sizeof(ast_node_t));\n"
+        "    if(node == NULL)\n"
+        "        fatal_error(\"cannot allocate a node\\n\");\n"
+        "\n"
+        "    memset(node, 0, sizeof(ast_node_t));\n"
+        "    node->type = type;\n"
+        "    return node;\n"
+        "}\n"
+        "\n"
+        "void destroy_ast_node(ast_node_t* node) {\n"
+        "\n"
+        "    if(node != NULL) {\n"
+        "        for(int i = 0; i < node->len; i++)\n"
+        "            destroy_ast_node(node->elems[i].nterm);\n"
+        "        PARSER_FREE(node->elems);\n"
+        "        PARSER_FREE(node);\n"
+        "    }\n"
+        "}\n"
+        "\n"
+        "static inline void add_ast_elem(ast_node_t* node, token_t* term, ast_node_t* nterm) {\n"
+        "\n"
+        "    if(node->len == node->cap) {\n"
+        "        node->cap = (node->cap == 0) ? 4 : node->cap * 2;\n"
+        "        node->elems = PARSER_REALLOC(node->elems, sizeof(ast_element_t) * node->cap);\n"
+        "        if(node->elems == NULL)\n"
+        "            fatal_error(\"cannot allocate %d elements\\n\", node->cap);\n"
+        "    }\n"
+        "\n"
+        "    node->elems[node->len].term = term;\n"
+        "    node->elems[node->len].nterm = nterm;\n"
+        "    node->len++;\n"
+        "}\n"
+        "\n"
+        "${?static}static inline ${/static}void add_ast_term(ast_node_t* node, token_t* tok) {\n"
+        "\n"
+        "    add_ast_elem(node, tok, NULL);\n"
+        "}\n"
+        "\n"
+        "${?static}static inline ${/static}void add_ast_nterm(ast_node_t* node, ast_node_t* nterm) {\n"
+        "\n"
+        "    add_ast_elem(node, NULL, nterm);\n"
+        "}\n"
+        "\n"
+        "${?static}static inline ${/static}void truncate_ast_node(ast_node_t* node, int len) {\n"
+        "\n"
+        "    while(node->len > len)\n"
+        "        destroy_ast_node(node->elems[--node->len].nterm);\n"
+        "}\n"
+        "\n",
+
+    // a compact function tries its alternatives in order and stops at the
+    // first one that matches or at an error
+    [EMIT_COMPACT_FUNC] =
+        "${comment}"
+        "${?rule}"
+        "${?static}static ${/static}ast_node_t* parse_${name}(void) {\n"
+        "\n"
+        "    ENTER;\n"
+        "\n"
+        "    match_t m;\n"
+        "    begin_match(&m, create_ast_node(AST_${upper}));\n"
+        "${/rule}"
+        "${?helper}"
+        "static bool match_${name}_${index}(ast_node_t* ptr) {\n"
+        "\n"
+        "    ENTER;\n"
+        "\n"
+        "    match_t m;\n"
+        "    begin_match(&m, ptr);\n"
+        "${/helper}"
+        "\n"
+        "    bool result =\n"
+        "        (${body});\n"
+        "\n"
+        "${?rule}"
+        "    RETURN(end_rule(&m, result));\n"
+        "${/rule}"
+        "${?helper}"
+        "    RETURN(end_match(&m, result));\n"
+        "${/helper}"
+        "}\n",
+
+    [EMIT_COMPACT_AND] =
+        " &&\n"
+        "         ",
+
+    [EMIT_COMPACT_OR] =
+        ") ||\n"
+        "        (next_alt(&m) &&\n"
+        "         ",
+
+    // expected is NULL when a failure is not an error
+    [EMIT_COMPACT_NTERM] =
+        "match_rule(&m, parse_${call}, ${expected})",
+
+    [EMIT_COMPACT_TERM] =
+        "match_term(&m, ${term}, ${expected})",
+
+    [EMIT_COMPACT_HELPER] =
+        "match_call(&m, match_${name}_${index}, ${expected})",
+
+    [EMIT_COMPACT_OPTIONAL] =
+        "match_optional(&m, match_${name}_${index})",
+
+    [EMIT_COMPACT_REPEAT] =
+        "match_repeat(&m, match_${name}_${index})",
+
+    [EMIT_COMPACT_MORE] =
+        "match_more(&m, match_${name}_${index}, ${expected})",
+
+    // the state of a compact function
+    [EMIT_COMPACT_TYPES] =
+        "/*\n"
+        " * A compact function keeps where it started in the input and in its node,\n"
+        " * so that an alternative that does not match can be undone. Partial is\n"
+        " * set when an item of the alternative has matched.\n"
+        " */\n"
+        "typedef struct {\n"
+        "    ast_node_t* ptr;\n"
+        "    size_t post;\n"
+        "    int mark;\n"
+        "    bool partial;\n"
+        "    bool error;\n"
+        "} match_t;\n"
+        "\n"
+        "typedef ast_node_t* (*parse_func_t)(void);\n"
+        "typedef bool (*match_func_t)(ast_node_t* ptr);\n"
+        "\n"
+        "#ifdef __GNUC__\n"
+        "#define UNUSED __attribute__((unused))\n"
+        "#else\n"
+        "#define UNUSED\n"
+        "#endif\n"
+        "\n",
+
+    [EMIT_COMPACT_PROTOS] =
+        "/*\n"
+        " * The shared code of the rules, in parser_rt.c.\n"
+        " */\n"
+        "void begin_match(match_t* m, ast_node_t* ptr);\n"
+        "ast_node_t* end_rule(match_t* m, bool result);\n"
+        "bool end_match(match_t* m, bool result);\n"
+        "bool next_alt(match_t* m);\n"
+        "bool match_term(match_t* m, token_type_t type, const char* expected);\n"
+        "bool match_rule(match_t* m, parse_func_t func, const char* expected);\n"
+        "bool match_call(match_t* m, match_func_t func, const char* expected);\n"
+        "bool match_optional(match_t* m, match_func_t func);\n"
+        "bool match_repeat(match_t* m, match_func_t func);\n"
+        "bool match_more(match_t* m, match_func_t func, const char* expected);\n"
+        "\n",
+
+    // a match that is given what it expects is committed, so its failure
+    // is an error
+    [EMIT_COMPACT_RUNTIME] =
+        "${?static}static UNUSED ${/static}void begin_match(match_t* m, ast_node_t* ptr) {\n"
+        "\n"
+        "    m->ptr = ptr;\n"
+        "    m->post = post_token_queue();\n"
+        "    m->mark = ptr->len;\n"
+        "    m->partial = false;\n"
+        "    m->error = false;\n"
+        "}\n"
+        "\n"
+        "${?static}static UNUSED ${/static}ast_node_t* end_rule(match_t* m, bool result) {\n"
+        "\n"
+        "    if(result)\n"
+        "        return m->ptr;\n"
+        "\n"
+        "    if(!m->error)\n"
+        "        reset_token_queue(m->post);\n"
+        "    destroy_ast_node(m->ptr);\n"
+        "    return NULL;\n"
+        "}\n"
+        "\n"
+        "${?static}static UNUSED ${/static}bool end_match(match_t* m, bool result) {\n"
+        "\n"
+        "    if(!result && !m->error) {\n"
+        "        reset_token_queue(m->post);\n"
+        "        truncate_ast_node(m->ptr, m->mark);\n"
+        "    }\n"
+        "\n"
+        "    return result;\n"
+        "}\n"
+        "\n"
+        "// undo the last alternative if it matched a part, like the state machines\n"
+        "${?static}static UNUSED ${/static}bool next_alt(match_t* m) {\n"
+        "\n"
+        "    if(m->error)\n"
+        "        return false;\n"
+        "\n"
+        "    if(m->partial) {\n"
+        "        reset_token_queue(m->post);\n"
+        "        truncate_ast_node(m->ptr, m->mark);\n"
+        "        m->partial = false;\n"
+        "    }\n"
+        "\n"
+        "    return true;\n"
+        "}\n"
+        "\n"
+        "static UNUSED bool fail_match(match_t* m, const char* expected) {\n"
+        "\n"
+        "    if(expected != NULL) {\n"
+        "        EXPECTED(expected);\n"
+        "        m->error = true;\n"
+        "    }\n"
+        "\n"
+        "    return false;\n"
+        "}\n"
+        "\n"
+        "${?static}static UNUSED ${/static}bool match_term(match_t* m, token_type_t type, const char* expected) {\n"
+        "\n"
+        "    if(TTYPE != type)\n"
+        "        return fail_match(m, expected);\n"
+        "\n"
+        "    add_ast_term(m->ptr, consume_token());\n"
+        "    return m->partial = true;\n"
+        "}\n"
+        "\n"
+        "${?static}static UNUSED ${/static}bool match_rule(match_t* m, parse_func_t func, const char* expected) {\n"
+        "\n"
+        "    ast_node_t* nterm = func();\n"
+        "    if(nterm == NULL)\n"
+        "        return fail_match(m, expected);\n"
+        "\n"
+        "    add_ast_nterm(m->ptr, nterm);\n"
+        "    return m->partial = true;\n"
+        "}\n"
+        "\n"
+        "${?static}static UNUSED ${/static}bool match_call(match_t* m, match_func_t func, const char* expected) {\n"
+        "\n"
+        "    if(!func(m->ptr))\n"
+        "        return fail_match(m, expected);\n"
+        "\n"
+        "    return m->partial = true;\n"
+        "}\n"
+        "\n"
+        "${?static}static UNUSED ${/static}bool match_optional(match_t* m, match_func_t func) {\n"
+        "\n"
+        "    func(m->ptr);\n"
+        "    return m->partial = true;\n"
+        "}\n"
+        "\n"
+        "${?static}static UNUSED ${/static}bool match_repeat(match_t* m, match_func_t func) {\n"
+        "\n"
+        "    while(func(m->ptr)) {\n"
+        "    }\n"
+        "\n"
+        "    return m->partial = true;\n"
+        "}\n"
+        "\n"
+        "${?static}static UNUSED ${/static}bool match_more(match_t* m, match_func_t func, const char* expected) {\n"
+        "\n"
+        "    return match_call(m, func, expected) && match_repeat(m, func);\n"
+        "}\n"
+        "\n",
+
+    // a typed rule makes the struct of its rule and a helper fills the
+    // struct of its group, or the pointer to a node for a single rule
+    [EMIT_TYPED_FUNC] =
+        "${comment}"
+        "${?rule}"
+        "static ast_${name}_t* parse_${name}(void) {\n"
+        "\n"
+        "    ENTER;\n"
+        "\n"
+        "    ast_${name}_t* ptr = create_ast_node(sizeof(ast_${name}_t), AST_${upper});\n"
+        "${/rule}"
+        "${?helper}"
+        "static bool match_${name}_${index}(${target}* ptr) {\n"
+        "\n"
+        "    ENTER;\n"
+        "\n"
+        "    bool result = false;\n"
+        "${/helper}"
+        "\n"
+        "    int state = 100;\n"
+        "    bool finished = false;\n"
+        "\n"
+        "    size_t post = post_token_queue();\n"
+        "\n"
+        "    while(!finished) {\n"
+        "        switch(state) {\n"
+        "${body}"
+        "            case MATCH_STATE:\n"
+        "                TRACE;\n"
+        "${?helper}"
+        "                result = true;\n"
+        "${/helper}"
+        "                finished = true;\n"
+        "                break;\n"
+        "\n"
+        "            case NO_MATCH_STATE:\n"
+        "                TRACE;\n"
+        "                reset_token_queue(post);\n"
+        "${?part}"
+        "                clear_part_${name}_${index}(ptr);\n"
+        "${/part}"
+        "${?rule}"
+        "                destroy_ast_${name}(ptr);\n"
+        "                ptr = NULL;\n"
+        "${/rule}"
+        "                finished = true;\n"
+        "                break;\n"
+        "\n"
+        "            case ERROR_STATE:\n"
+        "                TRACE;\n"
+        "${?rule}"
+        "                destroy_ast_${name}(ptr);\n"
+        "                ptr = NULL;\n"
+        "${/rule}"
+        "                finished = true;\n"
+        "                break;\n"
+        "\n"
+        "            default:\n"
+        "                state_error(__func__, state);\n"
+        "        }\n"
+        "    }\n"
+        "\n"
+        "${?rule}"
+        "    RETURN(ptr);\n"
+        "${/rule}"
+        "${?helper}"
+        "    RETURN(result);\n"
+        "${/helper}"
+        "}\n",
+
+    [EMIT_TYPED_PROTO] =
+        "${?rule}"
+        "static void clear_ast_${name}(ast_${name}_t* ptr);\n"
+        "${/rule}"
+        "${?helper}"
+        "static bool match_${name}_${index}(${target}* ptr);\n"
+        "${/helper}"
+        "${?part}"
+        "static void clear_part_${name}_${index}(part_${name}_${index}_t* ptr);\n"
+        "${/part}",
+
+    // the alternative is set before it can store anything
+    [EMIT_TYPED_TAG] =
+        "                ptr->alt = ${tag};\n",
+
+    [EMIT_TYPED_CALL_NTERM] =
+        "                if(${?likely}LIKELY(${/likely}NULL != (${field} = parse_${call}())${?likely})${/likely})\n"
+        "                    state = ${next};\n",
+
+    // alternatives of single terminals are one token, because its type
+    // tells them apart
+    [EMIT_TYPED_MATCH_TERM] =
+        "                if(${?likely}LIKELY(${/likely}${cond}${?likely})${/likely}) {\n"
+        "                    ${field} = consume_token();\n"
+        "                    state = ${next};\n"
+        "                }\n",
+
+    [EMIT_TYPED_CALL_PART] =
+        "                if(${?likely}LIKELY(${/likely}match_${name}_${index}(&${field})${?likely})${/likely})\n"
+        "                    state = ${next};\n",
+
+    [EMIT_TYPED_CALL_FIRST] =
+        "                if(${?likely}LIKELY(${/likely}match_${name}_${index}(ADD_AST_ITEM(${field}))${?likely})${/likely})\n"
+        "                    state = ${next};\n",
+
+    [EMIT_TYPED_TERM_OPTIONAL] =
+        "                if(${cond})\n"
+        "                    ${field} = consume_token();\n"
+        "                state = ${next};\n",
+
+    [EMIT_TYPED_TERM_REPEAT] =
+        "                while(${cond})\n"
+        "                    ADD_AST_TERM(${field}, consume_token());\n"
+        "                state = ${next};\n",
+
+    [EMIT_TYPED_TERM_MORE] =
+        "                if(${?likely}LIKELY(${/likely}${cond}${?likely})${/likely}) {\n"
+        "                    do\n"
+        "                        ADD_AST_TERM(${field}, consume_token());\n"
+        "                    while(${cond});\n"
+        "                    state = ${next};\n"
+        "                }\n",
+
+    [EMIT_TYPED_CALL_OPTIONAL] =
+        "                match_${name}_${index}(&${field});\n"
+        "                state = ${next};\n",
+
+    // an optional group is only copied to the heap when it matched
+    [EMIT_TYPED_PART_OPTIONAL] =
+        "                {\n"
+        "                    part_${name}_${index}_t part = { 0 };\n"
+        "                    if(match_${name}_${index}(&part))\n"
+        "                        ${field} = copy_ast_part(&part, sizeof(part));\n"
+        "                    else\n"
+        "                        clear_part_${name}_${index}(&part);\n"
+        "                }\n"
+        "                state = ${next};\n",
+
+    [EMIT_TYPED_CALL_REPEAT] =
+        "                if(!match_${name}_${index}(ADD_AST_ITEM(${field}))) {\n"
+        "                    ${field}.len--;\n"
+        "                    state = ${next};\n"
+        "                }\n",
+
+    [EMIT_TYPED_PART_REPEAT] =
+        "                if(!match_${name}_${index}(ADD_AST_ITEM(${field}))) {\n"
+        "                    clear_part_${name}_${index}(DROP_AST_ITEM(${field}));\n"
+        "                    state = ${next};\n"
+        "                }\n",
+
+    // the alternative may have stored a part of a group or a list
+    [EMIT_TYPED_FAIL_NEXT] =
+        "                else {\n"
+        "                    ${clear}(ptr);\n"
+        "                    state = ${alt};\n"
+        "                }\n",
+
+    [EMIT_TYPED_FAIL_RESET] =
+        "                else {\n"
+        "                    reset_token_queue(post);\n"
+        "                    ${clear}(ptr);\n"
+        "                    state = ${alt};\n"
+        "                }\n",
+
+    // clearing a struct frees what it holds and leaves it as it was made
+    [EMIT_TYPED_CLEAR] =
+        "${?rule}"
+        "static void clear_ast_${name}(ast_${name}_t* ptr) {\n"
+        "${/rule}"
+        "${?helper}"
+        "static void clear_part_${name}_${index}(part_${name}_${index}_t* ptr) {\n"
+        "${/helper}"
+        "\n"
+        "${body}"
+        "${?rule}"
+        "    memset(ptr, 0, sizeof(*ptr));\n"
+        "    ptr->type = AST_${upper};\n"
+        "${/rule}"
+        "${?helper}"
+        "    memset(ptr, 0, sizeof(*ptr));\n"
+        "${/helper}"
+        "}\n",
+
+    [EMIT_TYPED_DESTROY] =
+        "static void destroy_ast_${name}(ast_${name}_t* ptr) {\n"
+        "\n"
+        "    if(ptr != NULL) {\n"
+        "        clear_ast_${name}(ptr);\n"
+        "        PARSER_FREE(ptr);\n"
+        "    }\n"
+        "}\n",
+
+    // the node types of a typed parser, which the program uses
+    [EMIT_TYPED_NODES] =
+        "/*\n"
+        " * Every node starts with the type of its rule and is cast to the struct of\n"
+        " * the rule by it. A field is a token or a node when its element matches one\n"
+        " * time, NULL when an optional element did not match, and a list when the\n"
+        " * element repeats. A rule or a group with alternatives has the one that\n"
+        " * matched in alt, from 1, and a struct for each of them in a union.\n"
+        " */\n"
+        "typedef struct _ast_node_t_ {\n"
+        "    ast_type_t type;\n"
+        "} ast_node_t;\n"
+        "\n"
+        "/*\n"
+        " * A list keeps its first item in place of the pointer to its items, so a\n"
+        " * list of one item is not allocated. AST_ITEM is item i of the list.\n"
+        " */\n"
+        "#define AST_LIST(T)   \\\n"
+        "    struct {          \\\n"
+        "        union {       \\\n"
+        "            T one;    \\\n"
+        "            T* items; \\\n"
+        "        };            \\\n"
+        "        int len;      \\\n"
+        "        int cap;      \\\n"
+        "    }\n"
+        "\n"
+        "#define AST_ITEM(list, i) (*((list).cap == 0 ? &(list).one : &(list).items[i]))\n"
+        "\n"
+        "${body}",
+
+    // the AST code of a typed parser, where every rule has its own struct
+    [EMIT_TYPED_AST] =
+        "static inline void* create_ast_node(size_t size, ast_type_t type) {\n"
+        "\n"
+        "    ast_node_t* node = PARSER_MALLOC(size);\n"
+        "    if(node == NULL)\n"
+        "        fatal_error(\"cannot allocate a node\\n\");\n"
+        "\n"
+        "    memset(node, 0, size);\n"
+        "    node->type = type;\n"
+        "    return node;\n"
+        "}\n"
+        "\n"
+        "/*\n"
+        " * Add an item to a list and return it cleared. One is the first item of the\n"
+        " * list and shares its space with the pointer to the items, so it is moved\n"
+        " * to the heap with the second item.\n"
+        " */\n"
+        "static inline void* add_ast_item(void* one, int* len, int* cap, size_t size) {\n"
+        "\n"
+        "    char** items = one;\n"
+        "\n"
+        "    if(*cap == 0 && *len == 0) {\n"
+        "        *len = 1;\n"
+        "        return memset(one, 0, size);\n"
+        "    }\n"
+        "\n"
+        "    if(*cap == 0) {\n"
+        "        char* heap = PARSER_MALLOC(size * 4);\n"
+        "        if(heap == NULL)\n"
+        "            fatal_error(\"cannot allocate %d items\\n\", 4);\n"
+        "        memcpy(heap, one, size);\n"
+        "        *items = heap;\n"
+        "        *cap = 4;\n"
+        "    }\n"
+        "    else if(*len == *cap) {\n"
+        "        *cap *= 2;\n"
+        "        *items = PARSER_REALLOC(*items, size * *cap);\n"
+        "        if(*items == NULL)\n"
+        "            fatal_error(\"cannot allocate %d items\\n\", *cap);\n"
+        "    }\n"
+        "\n"
+        "    return memset(*items + size * (*len)++, 0, size);\n"
+        "}\n"
+        "\n"
+        "static inline void* copy_ast_part(const void* part, size_t size) {\n"
+        "\n"
+        "    void* copy = PARSER_MALLOC(size);\n"
+        "    if(copy == NULL)\n"
+        "        fatal_error(\"cannot allocate a part of a node\\n\");\n"
+        "\n"
+        "    return memcpy(copy, part, size);\n"
+        "}\n"
+        "\n"
+        "#define ADD_AST_ITEM(list) add_ast_item(&(list).one, &(list).len, &(list).cap, sizeof((list).one))\n"
+        "#define ADD_AST_TERM(list, tok) (*(token_t**)ADD_AST_ITEM(list) = (tok))\n"
+        "#define DROP_AST_ITEM(list) ((list).len--, &AST_ITEM(list, (list).len))\n"
+        "\n"
+        "#define FREE_AST_LIST(list)            \\\n"
+        "    do {                               \\\n"
+        "        if((list).cap > 0)             \\\n"
+        "            PARSER_FREE((list).items); \\\n"
+        "    } while(false)\n"
+        "\n",
+
+    [EMIT_TYPED_DESTROY_NODE] =
+        "void destroy_ast_node(ast_node_t* node) {\n"
+        "\n"
+        "    if(node == NULL)\n"
+        "        return;\n"
+        "\n"
+        "    switch(node->type) {\n"
+        "${body}"
+        "        default:\n"
+        "            fatal_error(\"unknown node type in %s: %d\\n\", __func__, node->type);\n"
+        "    }\n"
+        "}\n",
+
+    [EMIT_TYPED_DESTROY_CASE] =
+        "        case AST_${upper}:\n"
+        "            destroy_ast_${name}((ast_${name}_t*)node);\n"
+        "            break;\n",
+
+    [EMIT_TYPED_RULE_PROTO] =
+        "static ast_${name}_t* parse_${name}(void);\n"
+        "static void destroy_ast_${name}(ast_${name}_t* ptr);\n",
+
+    [EMIT_TOKEN] =
+        "    ${term},\n",
+
+    [EMIT_TYPE] =
+        "    AST_${upper},\n",
+
+    [EMIT_RULE_PROTO] =
+        "${?static}static ${/static}ast_node_t* parse_${name}(void);\n",
+};
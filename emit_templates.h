@@ -0,0 +1,123 @@
+#ifndef _EMIT_TEMPLATES_H_
+#define _EMIT_TEMPLATES_H_
+
+/*
+ * The slots that the templates of the emitter can use. The names are in
+ * emit_slots in the same order.
+ */
+typedef enum {
+    EMIT_SLOT_GRAMMAR,
+    EMIT_SLOT_NAME,
+    EMIT_SLOT_UPPER,
+    EMIT_SLOT_INDEX,
+    EMIT_SLOT_STATE,
+    EMIT_SLOT_NEXT,
+    EMIT_SLOT_ALT,
+    EMIT_SLOT_CALL,
+    EMIT_SLOT_TERM,
+    EMIT_SLOT_EXPECTED,
+    EMIT_SLOT_COMMENT,
+    EMIT_SLOT_BODY,
+    EMIT_SLOT_RULE,
+    EMIT_SLOT_HELPER,
+    EMIT_SLOT_NTERM,
+    EMIT_SLOT_MARK,
+    EMIT_SLOT_TOKENS,
+    EMIT_SLOT_TYPES,
+    EMIT_SLOT_RULES,
+    EMIT_SLOT_STATIC,
+    EMIT_SLOT_START,
+    EMIT_SLOT_DECLS,
+    EMIT_SLOT_MACROS,
+    EMIT_SLOT_LIKELY,
+    EMIT_SLOT_RUNTIME,
+    EMIT_SLOT_COND,
+    EMIT_SLOT_NODES,
+    EMIT_SLOT_AST,
+    EMIT_SLOT_TYPED,
+    EMIT_SLOT_FIELD,
+    EMIT_SLOT_TARGET,
+    EMIT_SLOT_PART,
+    EMIT_SLOT_TAG,
+    EMIT_SLOT_CLEAR,
+    EMIT_SLOT_QUEUE,
+    EMIT_SLOT_ENTRY,
+    EMIT_NUM_SLOTS
+} emit_slot_t;
+
+/*
+ * The templates that make up a backend. A backend is a table of the text
+ * of every template.
+ */
+typedef enum {
+    EMIT_FILE_HEAD,
+    EMIT_PROTO,
+    EMIT_FUNC,
+    EMIT_CASE,
+    EMIT_BREAK,
+    EMIT_CALL_NTERM,
+    EMIT_MATCH_TERM,
+    EMIT_CALL_HELPER,
+    EMIT_TERM_OPTIONAL,
+    EMIT_TERM_REPEAT,
+    EMIT_TERM_MORE,
+    EMIT_CALL_OPTIONAL,
+    EMIT_CALL_REPEAT,
+    EMIT_FAIL_ERROR,
+    EMIT_FAIL_NEXT,
+    EMIT_FAIL_RESET,
+    EMIT_HEADER,
+    EMIT_DECLS,
+    EMIT_NODES,
+    EMIT_MACROS,
+    EMIT_AMALG_HEADER,
+    EMIT_AMALG_SOURCE,
+    EMIT_RUNTIME_SOURCE,
+    EMIT_QUEUE,
+    EMIT_ENTRY,
+    EMIT_AST,
+    EMIT_COMPACT_FUNC,
+    EMIT_COMPACT_AND,
+    EMIT_COMPACT_OR,
+    EMIT_COMPACT_NTERM,
+    EMIT_COMPACT_TERM,
+    EMIT_COMPACT_HELPER,
+    EMIT_COMPACT_OPTIONAL,
+    EMIT_COMPACT_REPEAT,
+    EMIT_COMPACT_MORE,
+    EMIT_COMPACT_TYPES,
+    EMIT_COMPACT_PROTOS,
+    EMIT_COMPACT_RUNTIME,
+    EMIT_TYPED_FUNC,
+    EMIT_TYPED_PROTO,
+    EMIT_TYPED_TAG,
+    EMIT_TYPED_CALL_NTERM,
+    EMIT_TYPED_MATCH_TERM,
+    EMIT_TYPED_CALL_PART,
+    EMIT_TYPED_CALL_FIRST,
+    EMIT_TYPED_TERM_OPTIONAL,
+    EMIT_TYPED_TERM_REPEAT,
+    EMIT_TYPED_TERM_MORE,
+    EMIT_TYPED_CALL_OPTIONAL,
+    EMIT_TYPED_PART_OPTIONAL,
+    EMIT_TYPED_CALL_REPEAT,
+    EMIT_TYPED_PART_REPEAT,
+    EMIT_TYPED_FAIL_NEXT,
+    EMIT_TYPED_FAIL_RESET,
+    EMIT_TYPED_CLEAR,
+    EMIT_TYPED_DESTROY,
+    EMIT_TYPED_NODES,
+    EMIT_TYPED_AST,
+    EMIT_TYPED_DESTROY_NODE,
+    EMIT_TYPED_DESTROY_CASE,
+    EMIT_TYPED_RULE_PROTO,
+    EMIT_TOKEN,
+    EMIT_TYPE,
+    EMIT_RULE_PROTO,
+    EMIT_NUM_TEMPLATES
+} emit_template_t;
+
+extern const char* emit_slots[EMIT_NUM_SLOTS];
+extern const char* c_templates[EMIT_NUM_TEMPLATES];
+
+#endif /* _EMIT_TEMPLATES_H_ */
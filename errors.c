@@ -1,8 +1,18 @@
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 
-static int errors = 0;
+#include "errors.h"
+
+// Every thread counts its own errors and can send them to its own file, so
+// that jobs that run at the same time keep their errors apart.
+static _Thread_local int errors = 0;
+static _Thread_local FILE* err_file = NULL;
+static _Thread_local bool quiet = false;
+static _Thread_local int quiet_errors = 0;
+
+#define ERR_FILE ((err_file != NULL) ? err_file : stderr)
 
 void fatal_error(const char* fmt, ...) {
 
@@ -22,12 +32,17 @@ void syntax_error(const char* file, int line, const char* fmt, ...) {
 
     va_list args;
 
-    fprintf(stderr, "ERROR: %s: %d: ", file, line);
+    if(quiet) {
+        quiet_errors++;
+        return;
+    }
+
+    fprintf(ERR_FILE, "ERROR: %s: %d: ", file, line);
 
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    vfprintf(ERR_FILE, fmt, args);
     va_end(args);
-    fputc('\n', stderr);
+    fputc('\n', ERR_FILE);
     errors++;
 }
 
@@ -35,12 +50,12 @@ void misc_error(const char* fmt, ...) {
 
     va_list args;
 
-    fprintf(stderr, "ERROR: ");
+    fprintf(ERR_FILE, "ERROR: ");
 
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    vfprintf(ERR_FILE, fmt, args);
     va_end(args);
-    fputc('\n', stderr);
+    fputc('\n', ERR_FILE);
     errors++;
 }
 
@@ -48,3 +63,28 @@ void misc_error(const char* fmt, ...) {
 int get_errors(void) {
     return errors;
 }
+
+/*
+ * Send the errors on this thread to a file and clear the count. NULL goes
+ * back to stderr.
+ */
+void set_error_file(FILE* fp) {
+
+    err_file = fp;
+    errors = 0;
+}
+
+/*
+ * While errors are quiet, the syntax errors on this thread are counted but
+ * not reported. This is used to try something that is done again if it
+ * fails. Turning it on clears the count.
+ */
+void set_quiet_errors(bool flag) {
+
+    quiet = flag;
+    quiet_errors = 0;
+}
+
+int get_quiet_errors(void) {
+    return quiet_errors;
+}
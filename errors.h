@@ -3,9 +3,15 @@
 #ifndef _ERRORS_H_
 #define _ERRORS_H_
 
+#include <stdbool.h>
+#include <stdio.h>
+
 void fatal_error(const char* fmt, ...);
 void syntax_error(const char* file, int line, const char* fmt, ...);
 void misc_error(const char* fmt, ...);
 int get_errors(void);
+void set_error_file(FILE* fp);
+void set_quiet_errors(bool flag);
+int get_quiet_errors(void);
 
 #endif /* _ERRORS_H_ */
@@ -1,31 +1,362 @@
+#define _POSIX_C_SOURCE 200809L
 
-// #include <errno.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
-// #include <string.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-// #include "ast.h"
+#include "ast.h"
+#include "ast_pass.h"
+#include "emit.h"
+#include "errors.h"
+#include "memory.h"
+#include "out_buffer.h"
 #include "parser.h"
 #include "regurge.h"
 #include "scanner.h"
+#include "thread_pool.h"
+#include "watch.h"
+
+typedef struct {
+    bool share;
+    bool stream;
+    bool events;
+    bool check;
+    bool lazy;
+    bool parallel;
+    bool watch;
+    const char* out_dir;
+    emit_options_t emit;
+} options_t;
+
+/*
+ * A file in a batch. The output and the errors are kept until all of the
+ * files are finished so they can be printed in the order of the files.
+ */
+typedef struct {
+    const char* fname;
+    options_t* opts;
+    char* out;
+    size_t out_len;
+    char* err;
+    size_t err_len;
+    double secs;
+    int status;
+} job_t;
+
+typedef struct {
+    FILE* fp;
+    int depth;
+} event_ctx_t;
+
+// the stream mode writes every rule when it has been parsed
+typedef struct {
+    out_buffer_t* buf;
+    FILE* fp;
+} stream_ctx_t;
+
+// the last output of the watch mode and the buffer for the next one
+typedef struct {
+    out_buffer_t* last;
+    out_buffer_t* next;
+    const char* fname;
+    options_t* opts;
+} watch_output_t;
+
+static void usage(const char* name) {
+
+    printf("syntax: %s [-s] [-m] [-e] [-c] [-l] [-p] [-j N] [-o dir] [--amalgamate] [--compact] [--typed] [--watch] filename ...\n", name);
+    printf("    -s  share identical AST subtrees and report the memory saved\n");
+    printf("    -m  stream the rules to the output as they are parsed\n");
+    printf("    -e  print the parse events without building an AST\n");
+    printf("    -c  only check that the input is a valid grammar\n");
+    printf("    -l  parse the rule bodies when they are first used\n");
+    printf("    -p  parse and print the top level rules on one thread per CPU\n");
+    printf("    -j  process the files on N threads and report the times\n");
+    printf("        with -o and one file, write the rules on N threads\n");
+    printf("    -o  write the generated parser into the directory\n");
+    printf("    --amalgamate  with -o, write the parser as one C file and a header\n");
+    printf("    --compact  with -o, write rules that call shared code to make the parser smaller\n");
+    printf("    --typed  with --amalgamate, give every rule a struct with a field for each element\n");
+    printf("    --watch  parse the file again every time that it is saved\n");
+    printf("             with -o, only the files of the rules that changed are written\n");
+    exit(1);
+}
+
+static double get_time(void) {
+
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void regurge_item(void* item, void* ctx) {
+
+    stream_ctx_t* ptr = (stream_ctx_t*)ctx;
+    ast_regurge(item, ptr->buf);
+    flush_out_buffer(ptr->buf, ptr->fp);
+}
+
+static void print_enter(ast_type_t type, void* ctx) {
+
+    event_ctx_t* ptr = (event_ctx_t*)ctx;
+    fprintf(ptr->fp, "%*senter: %s\n", ptr->depth, "", ast_type_to_str(type));
+    ptr->depth += 2;
+}
+
+static void print_exit(ast_type_t type, void* ctx) {
+
+    event_ctx_t* ptr = (event_ctx_t*)ctx;
+    ptr->depth -= 2;
+    fprintf(ptr->fp, "%*sexit: %s\n", ptr->depth, "", ast_type_to_str(type));
+}
+
+static void print_token(token_t* tok, void* ctx) {
+
+    event_ctx_t* ptr = (event_ctx_t*)ctx;
+    fprintf(ptr->fp, "%*stoken: %s: %s\n", ptr->depth, "", tok_type_to_str(tok), tok->text);
+}
+
+/*
+ * Process one file on this thread. The output goes to out and the report
+ * of shared nodes goes to err. Return non-zero if the file did not parse or
+ * any errors were reported on this thread while it was processed.
+ */
+static int process_file(const char* fname, options_t* opts, FILE* out, FILE* err) {
+
+    int status = 0;
+    int errors = get_errors();
+    size_t nodes, bytes;
+
+    set_ast_sharing(opts->share);
+    get_ast_sharing_stats(&nodes, &bytes);
+
+    if(opts->events) {
+        event_ctx_t ctx = { out, 0 };
+        parse_sink_t sink = { print_enter, print_exit, print_token, &ctx };
+        if(!parse_events(fname, &sink))
+            status = 1;
+    }
+    else if(opts->check) {
+        if(!parse_events(fname, NULL))
+            status = 1;
+    }
+    else if(opts->stream) {
+        stream_ctx_t ctx = { create_out_buffer(), out };
+        if(parse_stream(fname, regurge_item, &ctx) < 0)
+            status = 1;
+        destroy_out_buffer(ctx.buf);
+    }
+    else {
+        void* ast = opts->lazy ? parse_lazy(fname) :
+                    opts->parallel ? parse_parallel(fname, 0) : parse(fname);
+
+        // the parsers go on after most errors, so the AST is not enough
+        if(ast == NULL || get_errors() != errors)
+            status = 1;
+        else if(opts->out_dir != NULL) {
+            if(emit_parser(ast, fname, opts->out_dir, &opts->emit) != 0)
+                status = 1;
+        }
+        else {
+            // traverse_ast(ast, NULL);
+            out_buffer_t* buf = create_out_buffer();
+            ast_pass_manager_t* mgr = create_pass_manager();
+            if(opts->parallel)
+                set_pass_threads(mgr, 0);
+            add_regurge_pass(mgr, buf);
+            run_passes(mgr, ast);
+            destroy_pass_manager(mgr);
+            // the body of a lazy rule can fail when it is first used
+            if(get_errors() != errors)
+                status = 1;
+            else
+                flush_out_buffer(buf, out);
+            destroy_out_buffer(buf);
+        }
+
+        // while sharing is on, so that the shared nodes are freed once
+        destroy_ast(ast);
+    }
+
+    if(opts->share) {
+        size_t total_nodes, total_bytes;
+        get_ast_sharing_stats(&total_nodes, &total_bytes);
+        fprintf(err, "shared AST nodes: %lu, bytes saved: %lu\n",
+                total_nodes - nodes, total_bytes - bytes);
+    }
+
+    if(get_errors() != errors)
+        status = 1;
+
+    set_ast_sharing(false);
+    uninit_scanner();
+
+    return status;
+}
+
+/*
+ * The output is only written when it is not the same as the last time. The
+ * emitter only writes the files of the rules that changed.
+ */
+static void watch_output(parse_tree_t* tree, void* ctx) {
+
+    watch_output_t* ptr = (watch_output_t*)ctx;
+
+    if(ptr->opts->out_dir != NULL) {
+        emit_parser(tree->ast, ptr->fname, ptr->opts->out_dir, &ptr->opts->emit);
+        return;
+    }
+
+    out_buffer_t* next = ptr->next;
+    clear_out_buffer(next);
+    ast_regurge(tree->ast, next);
+
+    if(next->len != ptr->last->len || memcmp(next->text, ptr->last->text, next->len)) {
+        fwrite(next->text, 1, next->len, stdout);
+        fflush(stdout);
+        ptr->next = ptr->last;
+        ptr->last = next;
+    }
+}
+
+static void run_job(job_t* job) {
+
+    double start = get_time();
+    FILE* out = open_memstream(&job->out, &job->out_len);
+    FILE* err = open_memstream(&job->err, &job->err_len);
+
+    set_error_file(err);
+
+    // a file that cannot be opened only fails its own job
+    FILE* fp = fopen(job->fname, "r");
+    if(fp == NULL) {
+        fprintf(err, "cannot open input file: %s: %s\n", job->fname, strerror(errno));
+        job->status = 1;
+    }
+    else {
+        fclose(fp);
+        job->status = process_file(job->fname, job->opts, out, err);
+    }
+
+    set_error_file(NULL);
+    fclose(out);
+    fclose(err);
+
+    job->secs = get_time() - start;
+}
+
+/*
+ * Process the files on a thread pool. Every file is parsed with its own
+ * scanner and errors on the thread that runs it. The output, the errors and
+ * the time of every file are printed in the order of the files.
+ */
+static int run_batch(const char** files, int num_files, options_t* opts, int num_threads) {
+
+    double start = get_time();
+    job_t* jobs = _ALLOC_ARRAY(job_t, num_files);
+    thread_pool_t* pool = create_thread_pool(num_threads);
+
+    for(int i = 0; i < num_files; i++) {
+        jobs[i].fname = files[i];
+        jobs[i].opts = opts;
+        add_thread_pool_task(pool, (thread_task_t)run_job, &jobs[i]);
+    }
+
+    wait_thread_pool(pool);
+    destroy_thread_pool(pool);
+
+    int status = 0;
+    for(int i = 0; i < num_files; i++) {
+        fwrite(jobs[i].out, 1, jobs[i].out_len, stdout);
+        fflush(stdout);
+        fwrite(jobs[i].err, 1, jobs[i].err_len, stderr);
+        fprintf(stderr, "%s: %.3f s\n", jobs[i].fname, jobs[i].secs);
+
+        if(jobs[i].status != 0)
+            status = 1;
+
+        // these were made by open_memstream()
+        free(jobs[i].out);
+        free(jobs[i].err);
+    }
+
+    fprintf(stderr, "total: %d files, %.3f s\n", num_files, get_time() - start);
+
+    _FREE(jobs);
+    return status;
+}
 
 int main(int argc, char** argv) {
 
-    if(argc < 2) {
-        printf("syntax: %s filename\n", argv[0]);
-        return 1;
+    const char** files = _ALLOC_ARRAY(const char*, argc);
+    int num_files = 0;
+    int num_threads = 0;
+    options_t opts = { 0 };
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-s"))
+            opts.share = true;
+        else if(!strcmp(argv[i], "-m"))
+            opts.stream = true;
+        else if(!strcmp(argv[i], "-e"))
+            opts.events = true;
+        else if(!strcmp(argv[i], "-c"))
+            opts.check = true;
+        else if(!strcmp(argv[i], "-l"))
+            opts.lazy = true;
+        else if(!strcmp(argv[i], "-p"))
+            opts.parallel = true;
+        else if(!strcmp(argv[i], "--watch"))
+            opts.watch = true;
+        else if(!strcmp(argv[i], "--amalgamate"))
+            opts.emit.amalgamate = true;
+        else if(!strcmp(argv[i], "--compact"))
+            opts.emit.compact = true;
+        else if(!strcmp(argv[i], "--typed"))
+            opts.emit.typed = true;
+        else if(!strcmp(argv[i], "-j") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            num_threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-o") && i + 1 < argc)
+            opts.out_dir = argv[++i];
+        else if(argv[i][0] == '-')
+            usage(argv[0]);
+        else
+            files[num_files++] = argv[i];
     }
 
-    //     init_scanner(argv[1]);
+    if(num_files == 0 || (num_files > 1 && (num_threads == 0 || opts.watch || opts.out_dir != NULL)))
+        usage(argv[0]);
+
+    if((opts.emit.amalgamate || opts.emit.compact) && opts.out_dir == NULL)
+        usage(argv[0]);
+
+    // the typed nodes are built by state machines in one file
+    if(opts.emit.typed && (!opts.emit.amalgamate || opts.emit.compact))
+        usage(argv[0]);
+
+    opts.emit.threads = num_threads;
+
+    //     init_scanner(fname);
     //     for(token_t* tok = get_token(); tok->type != END_OF_INPUT; tok = consume_token()) {
     //         printf("%s: %s: %s\n", tok_type_to_str(tok), tok->text, tok->name);
     //     }
     //     return 0;
 
-    void* ast = parse(argv[1]);
-
-    // traverse_ast(ast, NULL);
-    ast_regurge(ast);
+    int status;
+    if(opts.watch) {
+        watch_output_t ctx = { create_out_buffer(), create_out_buffer(), files[0], &opts };
+        status = watch_grammar(files[0], watch_output, &ctx);
+        destroy_out_buffer(ctx.last);
+        destroy_out_buffer(ctx.next);
+    }
+    else if(num_files > 1)
+        status = run_batch(files, num_files, &opts, num_threads);
+    else
+        status = process_file(files[0], &opts, stdout, stderr);
 
-    uninit_scanner();
-    return 0;
+    _FREE(files);
+    return status;
 }
@@ -1,11 +1,57 @@
 
 #include "errors.h"
+#include "memory.h"
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef MEMORY_STATS
+#undef _mem_alloc
+#undef _mem_realloc
+#undef _mem_copy
+#undef _mem_copy_string
+#undef _mem_free
+#endif
+
+static _Thread_local mem_allocator_t* allocator = NULL;
+
+static inline void* raw_alloc(size_t size) {
+
+    return (allocator == NULL) ? malloc(size) : (*allocator->alloc)(allocator->ctx, size);
+}
+
+static inline void* raw_realloc(void* ptr, size_t size) {
+
+    return (allocator == NULL) ? realloc(ptr, size) : (*allocator->realloc)(allocator->ctx, ptr, size);
+}
+
+static inline void raw_free(void* ptr) {
+
+    if(allocator == NULL)
+        free(ptr);
+    else
+        (*allocator->free)(allocator->ctx, ptr);
+}
+
+/*
+ * Install an allocator on this thread and return the one that it replaces.
+ * Passing NULL goes back to libc.
+ */
+mem_allocator_t* set_allocator(mem_allocator_t* alloc) {
+
+    mem_allocator_t* prev = allocator;
+    allocator = alloc;
+
+    return prev;
+}
+
+mem_allocator_t* get_allocator(void) {
+
+    return allocator;
+}
+
 void* _mem_alloc(size_t size) {
 
-    void* ptr = malloc(size);
+    void* ptr = raw_alloc(size);
     if(ptr == NULL)
         fatal_error("cannot allocate %lu bytes", size);
 
@@ -15,7 +61,7 @@ void* _mem_alloc(size_t size) {
 
 void* _mem_realloc(void* optr, size_t size) {
 
-    void* nptr = realloc(optr, size);
+    void* nptr = raw_realloc(optr, size);
     if(nptr == NULL)
         fatal_error("cannot re-allocate %lu bytes", size);
 
@@ -24,7 +70,7 @@ void* _mem_realloc(void* optr, size_t size) {
 
 void* _mem_copy(void* optr, size_t size) {
 
-    void* nptr = malloc(size);
+    void* nptr = raw_alloc(size);
     if(nptr == NULL)
         fatal_error("cannot allocate to copy %lu bytes", size);
 
@@ -35,7 +81,7 @@ void* _mem_copy(void* optr, size_t size) {
 char* _mem_copy_string(const char* str) {
 
     size_t len = strlen(str) + 1;
-    char* ptr = malloc(len);
+    char* ptr = raw_alloc(len);
     if(ptr == NULL)
         fatal_error("cannot allocate %lu bytes for string", len);
 
@@ -46,5 +92,411 @@ char* _mem_copy_string(const char* str) {
 void _mem_free(void* ptr) {
 
     if(ptr != NULL)
-        free(ptr);
+        raw_free(ptr);
+}
+
+/*
+ * Bump allocator. Memory is taken from the end of the current block and is
+ * only given back when the arena is destroyed. Every allocation records its
+ * size so that realloc can copy it. The last allocation is grown in place
+ * when there is room.
+ */
+typedef struct _arena_block_t_ {
+    struct _arena_block_t_* next;
+    size_t size;
+    size_t used;
+} arena_block_t;
+
+typedef struct {
+    mem_allocator_t allocator;
+    arena_block_t* blocks;
+    size_t block_size;
+    void* last;
+} arena_t;
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define ARENA_ROUND(s) (((s) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(size_t))
+#define ARENA_DATA(b) ((char*)(b) + ARENA_ROUND(sizeof(arena_block_t)))
+#define ARENA_SIZE(p) (*(size_t*)((char*)(p) - ARENA_HEADER))
+
+static void* arena_alloc(void* ctx, size_t size) {
+
+    arena_t* arena = (arena_t*)ctx;
+    size_t need = ARENA_HEADER + ARENA_ROUND(size);
+    arena_block_t* block = arena->blocks;
+
+    if(block == NULL || block->used + need > block->size) {
+        size_t bsize = (need > arena->block_size) ? need : arena->block_size;
+        block = malloc(ARENA_ROUND(sizeof(arena_block_t)) + bsize);
+        if(block == NULL)
+            return NULL;
+        block->size = bsize;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    char* ptr = ARENA_DATA(block) + block->used + ARENA_HEADER;
+    block->used += need;
+    ARENA_SIZE(ptr) = size;
+    arena->last = ptr;
+
+    return ptr;
+}
+
+static void* arena_realloc(void* ctx, void* ptr, size_t size) {
+
+    arena_t* arena = (arena_t*)ctx;
+
+    if(ptr == NULL)
+        return arena_alloc(ctx, size);
+
+    size_t old = ARENA_SIZE(ptr);
+    arena_block_t* block = arena->blocks;
+
+    if(ptr == arena->last) {
+        size_t grow = ARENA_ROUND(size) - ARENA_ROUND(old);
+        if(size <= old || block->used + grow <= block->size) {
+            if(size > old)
+                block->used += grow;
+            ARENA_SIZE(ptr) = size;
+            return ptr;
+        }
+    }
+
+    void* nptr = arena_alloc(ctx, size);
+    if(nptr != NULL)
+        memcpy(nptr, ptr, (old < size) ? old : size);
+
+    return nptr;
+}
+
+static void arena_free(void* ctx, void* ptr) {
+
+    (void)ctx;
+    (void)ptr;
+}
+
+mem_allocator_t* create_arena_allocator(size_t block_size) {
+
+    arena_t* arena = calloc(1, sizeof(arena_t));
+    if(arena == NULL)
+        fatal_error("cannot allocate an arena");
+
+    arena->block_size = (block_size == 0) ? 1 << 16 : block_size;
+    arena->allocator.alloc = arena_alloc;
+    arena->allocator.realloc = arena_realloc;
+    arena->allocator.free = arena_free;
+    arena->allocator.ctx = arena;
+
+    return &arena->allocator;
+}
+
+void destroy_arena_allocator(mem_allocator_t* alloc) {
+
+    if(alloc != NULL) {
+        arena_t* arena = (arena_t*)alloc->ctx;
+        arena_block_t* next;
+
+        for(arena_block_t* block = arena->blocks; block != NULL; block = next) {
+            next = block->next;
+            free(block);
+        }
+
+        free(arena);
+    }
+}
+
+#ifdef MEMORY_STATS
+
+/*
+ * Instrumented allocation. Every block has a header in front of it that
+ * records its size and the call site that made it. The live blocks are kept
+ * in a list so that the ones that were never freed can be reported.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <threads.h>
+
+#define NUM_BUCKETS 16
+#define NUM_SITES 1024
+
+typedef struct _mem_site_t_ {
+    const char* file;
+    int line;
+    size_t allocs;
+    size_t reallocs;
+    size_t frees;
+    size_t bytes;
+    size_t zeroed;
+    size_t live;
+    size_t peak;
+    size_t live_blocks;
+    size_t hist[NUM_BUCKETS];
+    struct _mem_site_t_* next;
+} mem_site_t;
+
+typedef struct _mem_block_t_ {
+    mem_site_t* site;
+    struct _mem_block_t_* prev;
+    struct _mem_block_t_* next;
+    size_t size;
+} mem_block_t;
+
+#define HEADER_SIZE \
+    ((sizeof(mem_block_t) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+#define TO_BLOCK(p) ((mem_block_t*)((char*)(p) - HEADER_SIZE))
+#define TO_PTR(b) ((void*)((char*)(b) + HEADER_SIZE))
+
+static mem_site_t* sites[NUM_SITES];
+static mem_block_t* blocks = NULL;
+static size_t total_live = 0;
+static size_t total_peak = 0;
+static mtx_t lock;
+static once_flag lock_once = ONCE_FLAG_INIT;
+
+static void report(void);
+
+static void init_stats(void) {
+
+    mtx_init(&lock, mtx_plain);
+    atexit(report);
+}
+
+static int size_bucket(size_t size) {
+
+    int bucket = 0;
+
+    while(size > 1 && bucket < NUM_BUCKETS - 1) {
+        size >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/*
+ * Must be called with the lock held.
+ */
+static mem_site_t* find_site(const char* file, int line) {
+
+    size_t hash = (size_t)line;
+    for(const char* s = file; *s != '\0'; s++)
+        hash = hash * 31 + (unsigned char)*s;
+    hash %= NUM_SITES;
+
+    for(mem_site_t* site = sites[hash]; site != NULL; site = site->next) {
+        if(site->line == line && !strcmp(site->file, file))
+            return site;
+    }
+
+    mem_site_t* site = calloc(1, sizeof(mem_site_t));
+    if(site == NULL)
+        fatal_error("cannot allocate memory statistics");
+
+    site->file = file;
+    site->line = line;
+    site->next = sites[hash];
+    sites[hash] = site;
+
+    return site;
+}
+
+/*
+ * Must be called with the lock held.
+ */
+static void link_block(mem_block_t* block, mem_site_t* site, size_t size) {
+
+    block->site = site;
+    block->size = size;
+    block->prev = NULL;
+    block->next = blocks;
+    if(blocks != NULL)
+        blocks->prev = block;
+    blocks = block;
+
+    site->live += size;
+    site->live_blocks++;
+    if(site->live > site->peak)
+        site->peak = site->live;
+
+    total_live += size;
+    if(total_live > total_peak)
+        total_peak = total_live;
+}
+
+/*
+ * Must be called with the lock held.
+ */
+static void unlink_block(mem_block_t* block) {
+
+    if(block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        blocks = block->next;
+    if(block->next != NULL)
+        block->next->prev = block->prev;
+
+    block->site->live -= block->size;
+    block->site->live_blocks--;
+    total_live -= block->size;
+}
+
+static void* stat_alloc(size_t size, const char* file, int line, bool zero) {
+
+    call_once(&lock_once, init_stats);
+
+    mem_block_t* block = raw_alloc(HEADER_SIZE + size);
+    if(block == NULL)
+        fatal_error("cannot allocate %lu bytes at %s: %d", size, file, line);
+
+    if(zero)
+        memset(TO_PTR(block), 0, size);
+
+    mtx_lock(&lock);
+    mem_site_t* site = find_site(file, line);
+    site->allocs++;
+    site->bytes += size;
+    if(zero)
+        site->zeroed += size;
+    site->hist[size_bucket(size)]++;
+    link_block(block, site, size);
+    mtx_unlock(&lock);
+
+    return TO_PTR(block);
+}
+
+void* _mem_stat_alloc(size_t size, const char* file, int line) {
+
+    return stat_alloc(size, file, line, true);
+}
+
+void* _mem_stat_realloc(void* optr, size_t size, const char* file, int line) {
+
+    if(optr == NULL)
+        return stat_alloc(size, file, line, false);
+
+    mem_block_t* block = TO_BLOCK(optr);
+
+    mtx_lock(&lock);
+    unlink_block(block);
+    mtx_unlock(&lock);
+
+    block = raw_realloc(block, HEADER_SIZE + size);
+    if(block == NULL)
+        fatal_error("cannot re-allocate %lu bytes at %s: %d", size, file, line);
+
+    mtx_lock(&lock);
+    mem_site_t* site = find_site(file, line);
+    site->reallocs++;
+    site->bytes += size;
+    site->hist[size_bucket(size)]++;
+    link_block(block, site, size);
+    mtx_unlock(&lock);
+
+    return TO_PTR(block);
+}
+
+void* _mem_stat_copy(void* optr, size_t size, const char* file, int line) {
+
+    void* nptr = stat_alloc(size, file, line, false);
+    memcpy(nptr, optr, size);
+
+    return nptr;
+}
+
+char* _mem_stat_copy_string(const char* str, const char* file, int line) {
+
+    size_t len = strlen(str) + 1;
+    char* ptr = stat_alloc(len, file, line, false);
+    memcpy(ptr, str, len);
+
+    return ptr;
 }
+
+void _mem_stat_free(void* ptr) {
+
+    if(ptr != NULL) {
+        mem_block_t* block = TO_BLOCK(ptr);
+
+        mtx_lock(&lock);
+        block->site->frees++;
+        unlink_block(block);
+        mtx_unlock(&lock);
+
+        raw_free(block);
+    }
+}
+
+static int compare_sites(const void* left, const void* right) {
+
+    size_t l = (*(mem_site_t* const*)left)->bytes;
+    size_t r = (*(mem_site_t* const*)right)->bytes;
+
+    return (l < r) ? 1 : (l > r) ? -1 : 0;
+}
+
+static void report(void) {
+
+    mtx_lock(&lock);
+
+    size_t num = 0;
+    for(int i = 0; i < NUM_SITES; i++) {
+        for(mem_site_t* site = sites[i]; site != NULL; site = site->next)
+            num++;
+    }
+
+    mem_site_t** list = malloc(sizeof(mem_site_t*) * (num + 1));
+    if(list == NULL) {
+        mtx_unlock(&lock);
+        return;
+    }
+
+    num = 0;
+    for(int i = 0; i < NUM_SITES; i++) {
+        for(mem_site_t* site = sites[i]; site != NULL; site = site->next)
+            list[num++] = site;
+    }
+
+    qsort(list, num, sizeof(mem_site_t*), compare_sites);
+
+    fprintf(stderr, "\nmemory statistics by call site (peak live bytes: %lu)\n", total_peak);
+    fprintf(stderr, "%-28s %10s %8s %10s %12s %12s %12s\n",
+            "site", "allocs", "reallocs", "frees", "bytes", "zeroed", "peak");
+
+    for(size_t i = 0; i < num; i++) {
+        mem_site_t* site = list[i];
+        char name[64];
+
+        snprintf(name, sizeof(name), "%s: %d", site->file, site->line);
+        fprintf(stderr, "%-28s %10lu %8lu %10lu %12lu %12lu %12lu\n", name,
+                site->allocs, site->reallocs, site->frees, site->bytes,
+                site->zeroed, site->peak);
+
+        fprintf(stderr, "%-28s", "    sizes:");
+        for(int b = 0; b < NUM_BUCKETS; b++) {
+            if(site->hist[b] == 0)
+                continue;
+            if(b == NUM_BUCKETS - 1)
+                fprintf(stderr, " >=%lu:%lu", (size_t)1 << b, site->hist[b]);
+            else
+                fprintf(stderr, " <%lu:%lu", (size_t)1 << (b + 1), site->hist[b]);
+        }
+        fputc('\n', stderr);
+    }
+
+    fprintf(stderr, "\nunfreed blocks (%lu bytes)\n", total_live);
+    for(size_t i = 0; i < num; i++) {
+        mem_site_t* site = list[i];
+
+        if(site->live_blocks != 0)
+            fprintf(stderr, "%s: %d: %lu blocks, %lu bytes\n", site->file,
+                    site->line, site->live_blocks, site->live);
+    }
+
+    free(list);
+    mtx_unlock(&lock);
+}
+
+#endif
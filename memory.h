@@ -3,6 +3,33 @@
 
 #include <stddef.h>
 
+/*
+ * When this is defined, every allocation is recorded against the file and
+ * line that made it and a report is printed to stderr when the program
+ * exits. The report has the counts, bytes, bytes that were zeroed, peak live
+ * bytes and a histogram of sizes for every call site, and then the blocks
+ * that were never freed.
+ */
+// #define MEMORY_STATS
+
+/*
+ * All allocation goes through the allocator that is installed on the calling
+ * thread. When none is installed, libc is used. A block must be freed with
+ * the same allocator installed that allocated it. The allocator functions
+ * return NULL on failure and the macros below report it as a fatal error.
+ */
+typedef struct _mem_allocator_t_ {
+    void* (*alloc)(void* ctx, size_t size);
+    void* (*realloc)(void* ctx, void* ptr, size_t size);
+    void (*free)(void* ctx, void* ptr);
+    void* ctx;
+} mem_allocator_t;
+
+mem_allocator_t* set_allocator(mem_allocator_t* allocator);
+mem_allocator_t* get_allocator(void);
+mem_allocator_t* create_arena_allocator(size_t block_size);
+void destroy_arena_allocator(mem_allocator_t* allocator);
+
 #define _ALLOC(s) _mem_alloc(s)
 #define _ALLOC_DS(t) (t*)_mem_alloc(sizeof(t))
 #define _ALLOC_ARRAY(t, n) (t*)_mem_alloc(sizeof(t) * (n))
@@ -20,4 +47,18 @@ void* _mem_copy(void*, size_t);
 char* _mem_copy_string(const char*);
 void _mem_free(void*);
 
+#ifdef MEMORY_STATS
+#define _mem_alloc(s) _mem_stat_alloc((s), __FILE__, __LINE__)
+#define _mem_realloc(p, s) _mem_stat_realloc((p), (s), __FILE__, __LINE__)
+#define _mem_copy(p, s) _mem_stat_copy((p), (s), __FILE__, __LINE__)
+#define _mem_copy_string(s) _mem_stat_copy_string((s), __FILE__, __LINE__)
+#define _mem_free(p) _mem_stat_free(p)
+
+void* _mem_stat_alloc(size_t, const char*, int);
+void* _mem_stat_realloc(void*, size_t, const char*, int);
+void* _mem_stat_copy(void*, size_t, const char*, int);
+char* _mem_stat_copy_string(const char*, const char*, int);
+void _mem_stat_free(void*);
+#endif
+
 #endif /* _MEMORY_H_ */
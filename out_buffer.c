@@ -0,0 +1,129 @@
+/*
+ * Buffers for the output. The text of a file is built with the appends and
+ * written with a single call, so the output does not go through the locks
+ * and the formatting of stdio for every token. A file that is built in
+ * several buffers is written with writev.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "out_buffer.h"
+
+#define OUT_BUFFER_SIZE 4096
+
+out_buffer_t* create_out_buffer(void) {
+
+    out_buffer_t* buf = _ALLOC_DS(out_buffer_t);
+    buf->cap = OUT_BUFFER_SIZE;
+    buf->text = _ALLOC(buf->cap);
+    buf->len = 0;
+
+    return buf;
+}
+
+void destroy_out_buffer(out_buffer_t* buf) {
+
+    if(buf != NULL) {
+        _FREE(buf->text);
+        _FREE(buf);
+    }
+}
+
+/*
+ * Make room for len more characters and the terminator.
+ */
+void grow_out_buffer(out_buffer_t* buf, size_t len) {
+
+    while(buf->len + len >= buf->cap)
+        buf->cap <<= 1;
+
+    buf->text = _REALLOC(buf->text, buf->cap);
+}
+
+void add_out_int(out_buffer_t* buf, long val) {
+
+    char str[24];
+    char* ptr = &str[sizeof(str)];
+    unsigned long num = (val < 0) ? -(unsigned long)val : (unsigned long)val;
+
+    do {
+        *--ptr = '0' + (num % 10);
+        num /= 10;
+    } while(num != 0);
+
+    if(val < 0)
+        *--ptr = '-';
+
+    add_out_text(buf, ptr, &str[sizeof(str)] - ptr);
+}
+
+/*
+ * Write the text to the stream and clear the buffer. Return 0 or the errno
+ * of the failure.
+ */
+int flush_out_buffer(out_buffer_t* buf, FILE* fp) {
+
+    int status = 0;
+
+    if(buf->len > 0 && fwrite(buf->text, 1, buf->len, fp) != buf->len)
+        status = errno;
+
+    clear_out_buffer(buf);
+    return status;
+}
+
+/*
+ * Write the buffers to the file, one after the other. A short write is
+ * continued where it stopped, and there can be more buffers than writev
+ * takes at once. Return 0 or the errno of the failure.
+ */
+int write_out_file(const char* path, out_buffer_t** bufs, int num) {
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0)
+        return errno;
+
+    // 16 is the least that POSIX allows
+    long max = sysconf(_SC_IOV_MAX);
+    if(max <= 0)
+        max = 16;
+
+    struct iovec* iov = _ALLOC_ARRAY(struct iovec, num);
+    int first = 0;
+
+    for(int i = 0; i < num; i++) {
+        iov[i].iov_base = bufs[i]->text;
+        iov[i].iov_len = bufs[i]->len;
+    }
+
+    int status = 0;
+    while(first < num) {
+        ssize_t size = writev(fd, &iov[first], (num - first < max) ? num - first : max);
+        if(size < 0) {
+            if(errno == EINTR)
+                continue;
+            status = errno;
+            break;
+        }
+
+        while(first < num && (size_t)size >= iov[first].iov_len)
+            size -= iov[first++].iov_len;
+
+        if(first < num) {
+            iov[first].iov_base = (char*)iov[first].iov_base + size;
+            iov[first].iov_len -= size;
+        }
+    }
+
+    if(close(fd) != 0 && status == 0)
+        status = errno;
+
+    _FREE(iov);
+    return status;
+}
@@ -0,0 +1,67 @@
+#ifndef _OUT_BUFFER_H_
+#define _OUT_BUFFER_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Output is built in memory and written in one go. The buffer grows by
+ * doubling and always has a terminator after the text, so the text can be
+ * used as a string. The appends that are used for every token are inline
+ * and only call out when the buffer has to grow.
+ */
+typedef struct _out_buffer_t_ {
+    char* text;
+    size_t len;
+    size_t cap;
+} out_buffer_t;
+
+out_buffer_t* create_out_buffer(void);
+void destroy_out_buffer(out_buffer_t* buf);
+void grow_out_buffer(out_buffer_t* buf, size_t len);
+void add_out_int(out_buffer_t* buf, long val);
+int flush_out_buffer(out_buffer_t* buf, FILE* fp);
+int write_out_file(const char* path, out_buffer_t** bufs, int num);
+
+static inline void clear_out_buffer(out_buffer_t* buf) {
+
+    buf->len = 0;
+    buf->text[0] = '\0';
+}
+
+static inline void add_out_text(out_buffer_t* buf, const char* text, size_t len) {
+
+    if(buf->len + len >= buf->cap)
+        grow_out_buffer(buf, len);
+
+    memcpy(&buf->text[buf->len], text, len);
+    buf->len += len;
+    buf->text[buf->len] = '\0';
+}
+
+static inline void add_out_string(out_buffer_t* buf, const char* str) {
+
+    add_out_text(buf, str, strlen(str));
+}
+
+static inline void add_out_char(out_buffer_t* buf, int ch) {
+
+    if(buf->len + 1 >= buf->cap)
+        grow_out_buffer(buf, 1);
+
+    buf->text[buf->len++] = (char)ch;
+    buf->text[buf->len] = '\0';
+}
+
+static inline void add_out_indent(out_buffer_t* buf, int num) {
+
+    if(buf->len + num >= buf->cap)
+        grow_out_buffer(buf, num);
+
+    memset(&buf->text[buf->len], ' ', num);
+    buf->len += num;
+    buf->text[buf->len] = '\0';
+}
+
+#endif /* _OUT_BUFFER_H_ */
@@ -1,6 +1,8 @@
 
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +13,8 @@
 #include "parser.h"
 #include "pointer_list.h"
 #include "scanner.h"
+#include "thread_pool.h"
+#include "vector.h"
 
 #define MATCH_STATE 1000
 #define NO_MATCH_STATE 2000
@@ -34,11 +38,11 @@ static int num_states = 0;
         fprintf(stdout, "%*sENTER: %s\n", depth, "", __func__); \
         depth += DINC;                                          \
     } while(false)
-#define RETURN(v)                                                              \
-    do {                                                                       \
-        depth -= DINC;                                                         \
-        fprintf(stdout, "%*sRETURN(%p): %s\n", depth, "", (void*)v, __func__); \
-        return (v);                                                            \
+#define RETURN(v)                                                                        \
+    do {                                                                                 \
+        depth -= DINC;                                                                   \
+        fprintf(stdout, "%*sRETURN(%p): %s\n", depth, "", (void*)(intptr_t)v, __func__); \
+        return (v);                                                                      \
     } while(false)
 #define START           \
     do {                \
@@ -71,8 +75,60 @@ static int num_states = 0;
         PARSE_ERROR("expected %s but got \"%s\"", what, get_token()->text); \
     } while(false)
 
+/*
+ * When the parser is run by parse_events(), no AST is built. A rule that
+ * matches returns a pointer to a dummy node so that the caller can tell that
+ * it matched.
+ */
+#define BUILD_AST (!pstate->events)
+#define MATCHED(t) ((t*)&matched_node)
+
+#define ADD_NODE(l, n)                         \
+    do {                                       \
+        if(BUILD_AST) {                        \
+            if((l) == NULL)                    \
+                (l) = create_pointer_list();   \
+            add_pointer_list((l), (n));        \
+        }                                      \
+    } while(false)
+
+enum {
+    EVENT_ENTER,
+    EVENT_EXIT,
+    EVENT_TOKEN,
+};
+
+typedef struct {
+    int kind;
+    ast_type_t type;
+    token_t* tok;
+} parse_event_t;
+
+DEFINE_VECTOR(event_list, parse_event_t, 64)
+
+static ast_node_t matched_node;
+
+/*
+ * A top level rule in a parse_tree_t. The span is from the first token of
+ * the rule to the token after it, and count is the number of tokens. Line
+ * is the line of the first token and last_line is the line of the last one.
+ */
+typedef struct {
+    ast_node_t* rule;
+    pointer_list_t* tokens;
+    size_t start;
+    size_t end;
+    size_t count;
+    int line;
+    int last_line;
+    bool reused;
+} parse_item_t;
+
+DEFINE_VECTOR(parse_item_list, parse_item_t, 16)
+
 static ast_grammar_t* parse_grammar(parser_state_t* pstate);
 static ast_non_terminal_rule_t* parse_non_terminal_rule(parser_state_t* pstate);
+static bool parse_rule_body(parser_state_t* pstate, pointer_list_t** list);
 static ast_terminal_rule_t* parse_terminal_rule(parser_state_t* pstate);
 static ast_rule_element_t* parse_rule_element(parser_state_t* pstate);
 static ast_one_or_more_func_t* parse_one_or_more_func(parser_state_t* pstate);
@@ -80,7 +136,135 @@ static ast_zero_or_one_func_t* parse_zero_or_one_func(parser_state_t* pstate);
 static ast_zero_or_more_func_t* parse_zero_or_more_func(parser_state_t* pstate);
 static ast_or_func_t* parse_or_func(parser_state_t* pstate);
 static ast_group_func_t* parse_group_func(parser_state_t* pstate);
+static int parse_grammar_stream(parser_state_t* pstate);
+static ast_grammar_t* parse_grammar_tree(parser_state_t* pstate);
+
+/*
+ * The events are recorded in the log as the rules are parsed. When a rule
+ * does not match, the events that it recorded are dropped. They are only
+ * handed to the sink when a top level rule is complete, because until then
+ * any of them could be undone by backtracking. If there is no sink then
+ * nothing is recorded.
+ */
+static int enter_event(parser_state_t* pstate, ast_type_t type) {
+
+    if(pstate->log == NULL)
+        return 0;
+
+    int mark = len_event_list(pstate->log);
+    add_event_list(pstate->log, (parse_event_t){ EVENT_ENTER, type, NULL });
+    return mark;
+}
+
+static void exit_event(parser_state_t* pstate, ast_type_t type) {
+
+    if(pstate->log != NULL)
+        add_event_list(pstate->log, (parse_event_t){ EVENT_EXIT, type, NULL });
+}
+
+static void token_event(parser_state_t* pstate, token_t* tok) {
+
+    if(pstate->log != NULL)
+        add_event_list(pstate->log, (parse_event_t){ EVENT_TOKEN, 0, tok });
+}
+
+static void reset_events(parser_state_t* pstate, int mark) {
+
+    if(pstate->log != NULL)
+        truncate_event_list(pstate->log, mark);
+}
+
+/*
+ * Deliver the events in the log to the sink. Once they are delivered the
+ * tokens are not needed any more and are released.
+ */
+static void commit_events(parser_state_t* pstate) {
+
+    if(!pstate->events)
+        return;
+
+    if(pstate->log != NULL) {
+        parse_sink_t* sink = pstate->sink;
+        int mark = 0;
+        int len = len_event_list(pstate->log);
+
+        while(mark < len) {
+            parse_event_t ev = iterate_event_list(pstate->log, &mark);
+            switch(ev.kind) {
+                case EVENT_ENTER:
+                    if(sink->enter != NULL)
+                        (*sink->enter)(ev.type, sink->ctx);
+                    break;
+                case EVENT_EXIT:
+                    if(sink->exit != NULL)
+                        (*sink->exit)(ev.type, sink->ctx);
+                    break;
+                case EVENT_TOKEN:
+                    if(sink->token != NULL)
+                        (*sink->token)(ev.tok, sink->ctx);
+                    break;
+            }
+        }
+        truncate_event_list(pstate->log, 0);
+    }
 
+    release_tokens();
+}
+
+static parser_state_t lazy_state;
+
+/*
+ * A rule that is marked with '~' has its body skipped by parse_lazy(), so
+ * the body has to start and end with operators that can be
+ * matched like brackets. This uses the shape of the body that was recorded
+ * by parse_rule_body(), so it works when no AST is built.
+ */
+static void check_lazy_rule(parser_state_t* pstate, token_t* nterm) {
+
+    if(pstate->body_len < 2 || !pstate->body_opens || !pstate->body_closes)
+        syntax_error(get_file_name(), nterm->line_no,
+                "the lazy rule \"%s\" must start and end with an operator",
+                nterm->text);
+}
+
+/*
+ * Parse the body of a rule that was skipped by parse_lazy(). The scanner
+ * has to still hold the tokens of the input. Returns false if there was an
+ * error, and then the rule has no elements.
+ */
+bool load_rule_body(ast_non_terminal_rule_t* nterm) {
+
+    assert(nterm != NULL);
+
+    if(nterm->body == 0)
+        return true;
+
+    size_t post = post_token_queue();
+    reset_token_queue(nterm->body);
+
+    // the parser goes on after most errors, so they are counted
+    int errors = get_errors();
+    pointer_list_t* list = NULL;
+    bool retv = parse_rule_body(&lazy_state, &list) && get_errors() == errors;
+
+    if(!retv && list != NULL) {
+        int next = 0;
+        void* node;
+        while(NULL != (node = iterate_pointer_list(list, &next)))
+            destroy_ast(node);
+        destroy_pointer_list(list);
+        list = NULL;
+    }
+
+    nterm->rule_elems = (list != NULL) ? list : create_pointer_list();
+    nterm->body = 0;
+    reset_token_queue(post);
+
+    if(retv && nterm->lazy)
+        check_lazy_rule(&lazy_state, nterm->nterm);
+
+    return retv;
+}
 
 /*
  * grammar {
@@ -98,7 +282,8 @@ static ast_grammar_t* parse_grammar(parser_state_t* pstate) {
     int state = 100;
     bool finished = false;
 
-    int post = post_token_queue();
+    size_t post = post_token_queue();
+    int mark = enter_event(pstate, AST_GRAMMAR);
 
     ast_node_t* rule = NULL;
     pointer_list_t* list = NULL;
@@ -108,13 +293,13 @@ static ast_grammar_t* parse_grammar(parser_state_t* pstate) {
             case 100:
                 TRACE;
                 if(NULL != (rule = (ast_node_t*)parse_non_terminal_rule(pstate))) {
-                    list = create_pointer_list();
-                    add_pointer_list(list, rule);
+                    ADD_NODE(list, rule);
+                    commit_events(pstate);
                     state = 110;
                 }
                 else if(NULL != (rule = (ast_node_t*)parse_terminal_rule(pstate))) {
-                    list = create_pointer_list();
-                    add_pointer_list(list, rule);
+                    ADD_NODE(list, rule);
+                    commit_events(pstate);
                     state = 110;
                 }
                 else {
@@ -125,10 +310,14 @@ static ast_grammar_t* parse_grammar(parser_state_t* pstate) {
 
             case 110:
                 TRACE;
-                if(NULL != (rule = (ast_node_t*)parse_non_terminal_rule(pstate)))
-                    add_pointer_list(list, rule);
-                else if(NULL != (rule = (ast_node_t*)parse_terminal_rule(pstate)))
-                    add_pointer_list(list, rule);
+                if(NULL != (rule = (ast_node_t*)parse_non_terminal_rule(pstate))) {
+                    ADD_NODE(list, rule);
+                    commit_events(pstate);
+                }
+                else if(NULL != (rule = (ast_node_t*)parse_terminal_rule(pstate))) {
+                    ADD_NODE(list, rule);
+                    commit_events(pstate);
+                }
                 else
                     state = 120;
                 break;
@@ -136,7 +325,7 @@ static ast_grammar_t* parse_grammar(parser_state_t* pstate) {
             case 120:
                 TRACE;
                 if(TTYPE == END_OF_INPUT) {
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = MATCH_STATE;
                 }
                 else {
@@ -147,19 +336,26 @@ static ast_grammar_t* parse_grammar(parser_state_t* pstate) {
 
             case MATCH_STATE:
                 TRACE;
-                ptr = (ast_grammar_t*)create_ast_node(AST_GRAMMAR);
-                ptr->rules = list;
+                if(BUILD_AST) {
+                    ptr = (ast_grammar_t*)create_ast_node(AST_GRAMMAR);
+                    ptr->rules = list;
+                }
+                else
+                    ptr = MATCHED(ast_grammar_t);
+                exit_event(pstate, AST_GRAMMAR);
                 finished = true;
                 break;
 
             case NO_MATCH_STATE:
                 TRACE;
                 reset_token_queue(post);
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
             case ERROR_STATE:
                 TRACE;
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
@@ -186,7 +382,8 @@ static ast_terminal_rule_t* parse_terminal_rule(parser_state_t* pstate) {
     int state = 100;
     bool finished = false;
 
-    int post = post_token_queue();
+    size_t post = post_token_queue();
+    int mark = enter_event(pstate, AST_TERMINAL_RULE);
 
     token_t* term_sym = NULL;
     token_t* term_expr = NULL;
@@ -197,7 +394,7 @@ static ast_terminal_rule_t* parse_terminal_rule(parser_state_t* pstate) {
                 TRACE;
                 if(TTYPE == TERMINAL_SYMBOL) {
                     term_sym = get_token();
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = 110;
                 }
                 else {
@@ -210,7 +407,7 @@ static ast_terminal_rule_t* parse_terminal_rule(parser_state_t* pstate) {
                 TRACE;
                 if(TTYPE == TERMINAL_EXPR) {
                     term_expr = get_token();
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = MATCH_STATE;
                 }
                 else {
@@ -221,20 +418,27 @@ static ast_terminal_rule_t* parse_terminal_rule(parser_state_t* pstate) {
 
             case MATCH_STATE:
                 TRACE;
-                ptr = (ast_terminal_rule_t*)create_ast_node(AST_TERMINAL_RULE);
-                ptr->term_sym = term_sym;
-                ptr->term_expr = term_expr;
+                if(BUILD_AST) {
+                    ptr = (ast_terminal_rule_t*)create_ast_node(AST_TERMINAL_RULE);
+                    ptr->term_sym = term_sym;
+                    ptr->term_expr = term_expr;
+                }
+                else
+                    ptr = MATCHED(ast_terminal_rule_t);
+                exit_event(pstate, AST_TERMINAL_RULE);
                 finished = true;
                 break;
 
             case NO_MATCH_STATE:
                 TRACE;
                 reset_token_queue(post);
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
             case ERROR_STATE:
                 TRACE;
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
@@ -249,9 +453,11 @@ static ast_terminal_rule_t* parse_terminal_rule(parser_state_t* pstate) {
 
 /*
  * non_terminal_rule {
- *     NON_TERMINAL '{' +rule_element '}'
+ *     ?'~' NON_TERMINAL rule_body
  * }
  *
+ * When the parser is run by parse_lazy(), the body of every rule is skipped
+ * by using the bracket match index and it is parsed by load_rule_body().
  */
 static ast_non_terminal_rule_t* parse_non_terminal_rule(parser_state_t* pstate) {
 
@@ -263,20 +469,35 @@ static ast_non_terminal_rule_t* parse_non_terminal_rule(parser_state_t* pstate)
     int state = 100;
     bool finished = false;
 
-    int post = post_token_queue();
+    size_t post = post_token_queue();
+    int mark = enter_event(pstate, AST_NON_TERMINAL_RULE);
 
     token_t* nterm;
-    pointer_list_t* rule_elems;
-    ast_rule_element_t* elem;
+    pointer_list_t* rule_elems = NULL;
+    bool lazy = false;
+    size_t body = 0;
 
     while(!finished) {
         switch(state) {
             case 100:
+                TRACE;
+                if(TTYPE == LAZY) {
+                    token_event(pstate, consume_token());
+                    lazy = true;
+                }
+                state = 110;
+                break;
+
+            case 110:
                 TRACE;
                 if(TTYPE == NON_TERMINAL) {
                     nterm = get_token();
-                    consume_token();
-                    state = 110;
+                    token_event(pstate, consume_token());
+                    state = 120;
+                }
+                else if(lazy) {
+                    EXPECTED("a non-terminal symbol");
+                    state = ERROR_STATE;
                 }
                 else {
                     // EXPECTED("a non-terminal symbol");
@@ -284,11 +505,95 @@ static ast_non_terminal_rule_t* parse_non_terminal_rule(parser_state_t* pstate)
                 }
                 break;
 
-            case 110:
+            case 120:
+                TRACE;
+                // skip the body and parse it when it is first used
+                if(pstate->lazy && TTYPE == OCURLY &&
+                        0 != (body = match_bracket(post_token_queue()))) {
+                    size_t close = body;
+                    body = post_token_queue();
+                    reset_token_queue(close);
+                    state = 130;
+                }
+                else if(parse_rule_body(pstate, &rule_elems))
+                    state = MATCH_STATE;
+                else
+                    state = ERROR_STATE;
+                break;
+
+            case 130:
+                TRACE;
+                token_event(pstate, consume_token());
+                state = MATCH_STATE;
+                break;
+
+            case MATCH_STATE:
+                TRACE;
+                if(BUILD_AST) {
+                    ptr = (ast_non_terminal_rule_t*)create_ast_node(AST_NON_TERMINAL_RULE);
+                    ptr->nterm = nterm;
+                    ptr->rule_elems = rule_elems;
+                    ptr->lazy = lazy;
+                    ptr->body = body;
+                }
+                else
+                    ptr = MATCHED(ast_non_terminal_rule_t);
+                if(lazy && body == 0)
+                    check_lazy_rule(pstate, nterm);
+                exit_event(pstate, AST_NON_TERMINAL_RULE);
+                finished = true;
+                break;
+
+            case NO_MATCH_STATE:
+                TRACE;
+                reset_token_queue(post);
+                reset_events(pstate, mark);
+                finished = true;
+                break;
+
+            case ERROR_STATE:
+                TRACE;
+                reset_events(pstate, mark);
+                finished = true;
+                break;
+
+            default:
+                fatal_error("unknown state in %s: %d\n", __func__, state);
+        }
+    }
+
+    RETURN(ptr);
+}
+
+/*
+ * rule_body {
+ *     '{' +rule_element '}'
+ * }
+ *
+ * The rule elements are added to the list. This is also used to parse the
+ * body of a rule that was skipped by a lazy parse.
+ */
+static bool parse_rule_body(parser_state_t* pstate, pointer_list_t** list) {
+
+    ENTER;
+
+    assert(pstate != NULL);
+    assert(list != NULL);
+
+    int state = 100;
+    bool finished = false;
+    bool retv = false;
+
+    ast_rule_element_t* elem;
+    bool oper;
+
+    while(!finished) {
+        switch(state) {
+            case 100:
                 TRACE;
                 if(TTYPE == OCURLY) {
-                    consume_token();
-                    state = 120;
+                    token_event(pstate, consume_token());
+                    state = 110;
                 }
                 else {
                     EXPECTED("a \"{\"");
@@ -296,12 +601,15 @@ static ast_non_terminal_rule_t* parse_non_terminal_rule(parser_state_t* pstate)
                 }
                 break;
 
-            case 120:
+            case 110:
                 TRACE;
+                // an element that starts with an operator is only the operator
+                pstate->body_opens = (TTYPE == TERMINAL_OPER);
                 if(NULL != (elem = parse_rule_element(pstate))) {
-                    rule_elems = create_pointer_list();
-                    add_pointer_list(rule_elems, elem);
-                    state = 130;
+                    ADD_NODE(*list, elem);
+                    pstate->body_closes = pstate->body_opens;
+                    pstate->body_len = 1;
+                    state = 120;
                 }
                 else {
                     PARSE_ERROR(
@@ -310,18 +618,22 @@ static ast_non_terminal_rule_t* parse_non_terminal_rule(parser_state_t* pstate)
                 }
                 break;
 
-            case 130:
+            case 120:
                 TRACE;
-                if(NULL != (elem = parse_rule_element(pstate)))
-                    add_pointer_list(rule_elems, elem);
+                oper = (TTYPE == TERMINAL_OPER);
+                if(NULL != (elem = parse_rule_element(pstate))) {
+                    ADD_NODE(*list, elem);
+                    pstate->body_closes = oper;
+                    pstate->body_len++;
+                }
                 else
-                    state = 140;
+                    state = 130;
                 break;
 
-            case 140:
+            case 130:
                 TRACE;
                 if(TTYPE == CCURLY) {
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = MATCH_STATE;
                 }
                 else {
@@ -332,15 +644,7 @@ static ast_non_terminal_rule_t* parse_non_terminal_rule(parser_state_t* pstate)
 
             case MATCH_STATE:
                 TRACE;
-                ptr = (ast_non_terminal_rule_t*)create_ast_node(AST_NON_TERMINAL_RULE);
-                ptr->nterm = nterm;
-                ptr->rule_elems = rule_elems;
-                finished = true;
-                break;
-
-            case NO_MATCH_STATE:
-                TRACE;
-                reset_token_queue(post);
+                retv = true;
                 finished = true;
                 break;
 
@@ -354,7 +658,7 @@ static ast_non_terminal_rule_t* parse_non_terminal_rule(parser_state_t* pstate)
         }
     }
 
-    RETURN(ptr);
+    RETURN(retv);
 }
 
 /*
@@ -381,7 +685,8 @@ static ast_rule_element_t* parse_rule_element(parser_state_t* pstate) {
     int state = 100;
     bool finished = false;
 
-    int post = post_token_queue();
+    size_t post = post_token_queue();
+    int mark = enter_event(pstate, AST_RULE_ELEMENT);
 
     token_t* term = NULL;
     ast_node_t* nterm = NULL;
@@ -392,7 +697,7 @@ static ast_rule_element_t* parse_rule_element(parser_state_t* pstate) {
                 TRACE;
                 if(TTYPE == NON_TERMINAL) {
                     term = get_token();
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = MATCH_STATE;
                 }
                 else
@@ -403,7 +708,7 @@ static ast_rule_element_t* parse_rule_element(parser_state_t* pstate) {
                 TRACE;
                 if(TTYPE == TERMINAL_NAME) {
                     term = get_token();
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = MATCH_STATE;
                 }
                 else
@@ -414,7 +719,7 @@ static ast_rule_element_t* parse_rule_element(parser_state_t* pstate) {
                 TRACE;
                 if(TTYPE == TERMINAL_OPER) {
                     term = get_token();
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = MATCH_STATE;
                 }
                 else
@@ -425,7 +730,7 @@ static ast_rule_element_t* parse_rule_element(parser_state_t* pstate) {
                 TRACE;
                 if(TTYPE == TERMINAL_SYMBOL) {
                     term = get_token();
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = MATCH_STATE;
                 }
                 else
@@ -476,20 +781,28 @@ static ast_rule_element_t* parse_rule_element(parser_state_t* pstate) {
 
             case MATCH_STATE:
                 TRACE;
-                ptr = (ast_rule_element_t*)create_ast_node(AST_RULE_ELEMENT);
-                ptr->term = term;
-                ptr->nterm = nterm;
+                if(BUILD_AST) {
+                    ptr = (ast_rule_element_t*)create_ast_node(AST_RULE_ELEMENT);
+                    ptr->term = term;
+                    ptr->nterm = nterm;
+                    ptr = (ast_rule_element_t*)share_ast_node((ast_node_t*)ptr);
+                }
+                else
+                    ptr = MATCHED(ast_rule_element_t);
+                exit_event(pstate, AST_RULE_ELEMENT);
                 finished = true;
                 break;
 
             case NO_MATCH_STATE:
                 TRACE;
                 reset_token_queue(post);
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
             case ERROR_STATE:
                 TRACE;
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
@@ -517,7 +830,8 @@ static ast_one_or_more_func_t* parse_one_or_more_func(parser_state_t* pstate) {
     int state = 100;
     bool finished = false;
 
-    int post = post_token_queue();
+    size_t post = post_token_queue();
+    int mark = enter_event(pstate, AST_ONE_OR_MORE_FUNC);
     ast_rule_element_t* re = NULL;
 
     while(!finished) {
@@ -525,7 +839,7 @@ static ast_one_or_more_func_t* parse_one_or_more_func(parser_state_t* pstate) {
             case 100:
                 TRACE;
                 if(TTYPE == ONE_OR_MORE) {
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = 110;
                 }
                 else
@@ -544,19 +858,27 @@ static ast_one_or_more_func_t* parse_one_or_more_func(parser_state_t* pstate) {
 
             case MATCH_STATE:
                 TRACE;
-                ptr = (ast_one_or_more_func_t*)create_ast_node(AST_ONE_OR_MORE_FUNC);
-                ptr->elem = re;
+                if(BUILD_AST) {
+                    ptr = (ast_one_or_more_func_t*)create_ast_node(AST_ONE_OR_MORE_FUNC);
+                    ptr->elem = re;
+                    ptr = (ast_one_or_more_func_t*)share_ast_node((ast_node_t*)ptr);
+                }
+                else
+                    ptr = MATCHED(ast_one_or_more_func_t);
+                exit_event(pstate, AST_ONE_OR_MORE_FUNC);
                 finished = true;
                 break;
 
             case NO_MATCH_STATE:
                 TRACE;
                 reset_token_queue(post);
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
             case ERROR_STATE:
                 TRACE;
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
@@ -584,7 +906,8 @@ static ast_zero_or_one_func_t* parse_zero_or_one_func(parser_state_t* pstate) {
     int state = 100;
     bool finished = false;
 
-    int post = post_token_queue();
+    size_t post = post_token_queue();
+    int mark = enter_event(pstate, AST_ZERO_OR_ONE_FUNC);
     ast_rule_element_t* re = NULL;
 
     while(!finished) {
@@ -592,7 +915,7 @@ static ast_zero_or_one_func_t* parse_zero_or_one_func(parser_state_t* pstate) {
             case 100:
                 TRACE;
                 if(TTYPE == ZERO_OR_ONE) {
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = 110;
                 }
                 else
@@ -611,19 +934,27 @@ static ast_zero_or_one_func_t* parse_zero_or_one_func(parser_state_t* pstate) {
 
             case MATCH_STATE:
                 TRACE;
-                ptr = (ast_zero_or_one_func_t*)create_ast_node(AST_ZERO_OR_ONE_FUNC);
-                ptr->elem = re;
+                if(BUILD_AST) {
+                    ptr = (ast_zero_or_one_func_t*)create_ast_node(AST_ZERO_OR_ONE_FUNC);
+                    ptr->elem = re;
+                    ptr = (ast_zero_or_one_func_t*)share_ast_node((ast_node_t*)ptr);
+                }
+                else
+                    ptr = MATCHED(ast_zero_or_one_func_t);
+                exit_event(pstate, AST_ZERO_OR_ONE_FUNC);
                 finished = true;
                 break;
 
             case NO_MATCH_STATE:
                 TRACE;
                 reset_token_queue(post);
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
             case ERROR_STATE:
                 TRACE;
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
@@ -651,7 +982,8 @@ static ast_zero_or_more_func_t* parse_zero_or_more_func(parser_state_t* pstate)
     int state = 100;
     bool finished = false;
 
-    int post = post_token_queue();
+    size_t post = post_token_queue();
+    int mark = enter_event(pstate, AST_ZERO_OR_MORE_FUNC);
     ast_rule_element_t* re = NULL;
 
     while(!finished) {
@@ -659,7 +991,7 @@ static ast_zero_or_more_func_t* parse_zero_or_more_func(parser_state_t* pstate)
             case 100:
                 TRACE;
                 if(TTYPE == ZERO_OR_MORE) {
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = 110;
                 }
                 else
@@ -678,19 +1010,27 @@ static ast_zero_or_more_func_t* parse_zero_or_more_func(parser_state_t* pstate)
 
             case MATCH_STATE:
                 TRACE;
-                ptr = (ast_zero_or_more_func_t*)create_ast_node(AST_ZERO_OR_MORE_FUNC);
-                ptr->elem = re;
+                if(BUILD_AST) {
+                    ptr = (ast_zero_or_more_func_t*)create_ast_node(AST_ZERO_OR_MORE_FUNC);
+                    ptr->elem = re;
+                    ptr = (ast_zero_or_more_func_t*)share_ast_node((ast_node_t*)ptr);
+                }
+                else
+                    ptr = MATCHED(ast_zero_or_more_func_t);
+                exit_event(pstate, AST_ZERO_OR_MORE_FUNC);
                 finished = true;
                 break;
 
             case NO_MATCH_STATE:
                 TRACE;
                 reset_token_queue(post);
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
             case ERROR_STATE:
                 TRACE;
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
@@ -718,7 +1058,8 @@ static ast_or_func_t* parse_or_func(parser_state_t* pstate) {
     int state = 100;
     bool finished = false;
 
-    int post = post_token_queue();
+    size_t post = post_token_queue();
+    int mark = enter_event(pstate, AST_OR_FUNC);
     ast_rule_element_t* re = NULL;
 
     while(!finished) {
@@ -726,7 +1067,7 @@ static ast_or_func_t* parse_or_func(parser_state_t* pstate) {
             case 100:
                 TRACE;
                 if(TTYPE == PIPE) {
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = 110;
                 }
                 else
@@ -745,19 +1086,27 @@ static ast_or_func_t* parse_or_func(parser_state_t* pstate) {
 
             case MATCH_STATE:
                 TRACE;
-                ptr = (ast_or_func_t*)create_ast_node(AST_OR_FUNC);
-                ptr->elem = re;
+                if(BUILD_AST) {
+                    ptr = (ast_or_func_t*)create_ast_node(AST_OR_FUNC);
+                    ptr->elem = re;
+                    ptr = (ast_or_func_t*)share_ast_node((ast_node_t*)ptr);
+                }
+                else
+                    ptr = MATCHED(ast_or_func_t);
+                exit_event(pstate, AST_OR_FUNC);
                 finished = true;
                 break;
 
             case NO_MATCH_STATE:
                 TRACE;
                 reset_token_queue(post);
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
             case ERROR_STATE:
                 TRACE;
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
@@ -785,7 +1134,8 @@ static ast_group_func_t* parse_group_func(parser_state_t* pstate) {
     int state = 100;
     bool finished = false;
 
-    int post = post_token_queue();
+    size_t post = post_token_queue();
+    int mark = enter_event(pstate, AST_GROUP_FUNC);
     pointer_list_t* list = NULL;
     ast_rule_element_t* re = NULL;
 
@@ -794,7 +1144,7 @@ static ast_group_func_t* parse_group_func(parser_state_t* pstate) {
             case 100:
                 TRACE;
                 if(TTYPE == OPAREN) {
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = 110;
                 }
                 else
@@ -804,8 +1154,7 @@ static ast_group_func_t* parse_group_func(parser_state_t* pstate) {
             case 110:
                 TRACE;
                 if(NULL != (re = parse_rule_element(pstate))) {
-                    list = create_pointer_list();
-                    add_pointer_list(list, re);
+                    ADD_NODE(list, re);
                     state = 120;
                 }
                 else {
@@ -817,14 +1166,14 @@ static ast_group_func_t* parse_group_func(parser_state_t* pstate) {
             case 120:
                 TRACE;
                 if(NULL != (re = parse_rule_element(pstate)))
-                    add_pointer_list(list, re);
+                    ADD_NODE(list, re);
                 else
                     state = 130;
                 break;
 
             case 130:
                 if(TTYPE == CPAREN) {
-                    consume_token();
+                    token_event(pstate, consume_token());
                     state = MATCH_STATE;
                 }
                 else {
@@ -835,19 +1184,27 @@ static ast_group_func_t* parse_group_func(parser_state_t* pstate) {
 
             case MATCH_STATE:
                 TRACE;
-                ptr = (ast_group_func_t*)create_ast_node(AST_GROUP_FUNC);
-                ptr->list = list;
+                if(BUILD_AST) {
+                    ptr = (ast_group_func_t*)create_ast_node(AST_GROUP_FUNC);
+                    ptr->list = list;
+                    ptr = (ast_group_func_t*)share_ast_node((ast_node_t*)ptr);
+                }
+                else
+                    ptr = MATCHED(ast_group_func_t);
+                exit_event(pstate, AST_GROUP_FUNC);
                 finished = true;
                 break;
 
             case NO_MATCH_STATE:
                 TRACE;
                 reset_token_queue(post);
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
             case ERROR_STATE:
                 TRACE;
+                reset_events(pstate, mark);
                 finished = true;
                 break;
 
@@ -859,6 +1216,574 @@ static ast_group_func_t* parse_group_func(parser_state_t* pstate) {
     RETURN(ptr);
 }
 
+/*
+ * grammar {
+ *    +(non_terminal_rule | terminal_rule) END_OF_INPUT
+ * }
+ *
+ * This is the same as parse_grammar() except that every rule is handed to
+ * the callback as soon as it is complete. After the callback returns, the
+ * rule and the tokens before the current one are freed, so the memory used
+ * is bounded by the largest rule instead of the whole input. Returns the
+ * number of rules, or -1 if there was an error.
+ */
+static int parse_grammar_stream(parser_state_t* pstate) {
+
+    ENTER;
+
+    assert(pstate != NULL);
+    int items = 0;
+
+    int state = 100;
+    bool finished = false;
+
+    ast_node_t* rule = NULL;
+
+    while(!finished) {
+        switch(state) {
+            case 100:
+            case 110:
+                TRACE;
+                if(NULL != (rule = (ast_node_t*)parse_non_terminal_rule(pstate)) ||
+                   NULL != (rule = (ast_node_t*)parse_terminal_rule(pstate))) {
+                    (*pstate->callback)(rule, pstate->ctx);
+                    destroy_ast(rule);
+                    release_tokens();
+                    items++;
+                    state = 110;
+                }
+                else if(state == 100) {
+                    PARSE_ERROR("grammar must contain at least one rule");
+                    state = ERROR_STATE;
+                }
+                else
+                    state = 120;
+                break;
+
+            case 120:
+                TRACE;
+                if(TTYPE == END_OF_INPUT) {
+                    token_event(pstate, consume_token());
+                    state = MATCH_STATE;
+                }
+                else {
+                    EXPECTED("end of input");
+                    state = ERROR_STATE;
+                }
+                break;
+
+            case MATCH_STATE:
+                TRACE;
+                finished = true;
+                break;
+
+            case ERROR_STATE:
+                TRACE;
+                items = -1;
+                finished = true;
+                break;
+
+            default:
+                fatal_error("unknown state in %s: %d\n", __func__, state);
+        }
+    }
+
+    RETURN(items);
+}
+
+/*
+ * Give the node its own copy of the tokens that it refers to, so that it
+ * does not depend on the scanner. The copies are kept in the list of the
+ * item that the node belongs to.
+ */
+static token_t* keep_token(pointer_list_t* list, token_t* tok) {
+
+    token_t* ptr = _COPY_DS(tok, token_t);
+    ptr->text = _COPY_STRING(tok->text);
+    if(tok->name != NULL)
+        ptr->name = _COPY_STRING(tok->name);
+
+    add_pointer_list(list, ptr);
+    return ptr;
+}
+
+static void keep_tokens(void* node, void* state) {
+
+    pointer_list_t* list = (pointer_list_t*)state;
+
+    switch(get_ast_node_type(node)) {
+        case AST_NON_TERMINAL_RULE: {
+            ast_non_terminal_rule_t* ptr = (ast_non_terminal_rule_t*)node;
+            ptr->nterm = keep_token(list, ptr->nterm);
+        } break;
+        case AST_TERMINAL_RULE: {
+            ast_terminal_rule_t* ptr = (ast_terminal_rule_t*)node;
+            ptr->term_sym = keep_token(list, ptr->term_sym);
+            ptr->term_expr = keep_token(list, ptr->term_expr);
+        } break;
+        case AST_RULE_ELEMENT: {
+            ast_rule_element_t* ptr = (ast_rule_element_t*)node;
+            if(ptr->term != NULL)
+                ptr->term = keep_token(list, ptr->term);
+        } break;
+        default:
+            break;
+    }
+}
+
+static void destroy_item(parse_item_t* item) {
+
+    int post = 0;
+    token_t* tok;
+
+    destroy_ast(item->rule);
+    while(NULL != (tok = iterate_pointer_list(item->tokens, &post))) {
+        _FREE(tok->text);
+        _FREE(tok->name);
+        _FREE(tok);
+    }
+    destroy_pointer_list(item->tokens);
+}
+
+/*
+ * Add a rule that was just parsed to the tree. It started with the token
+ * first at post and the current token is the one after it.
+ */
+static void add_item(parser_state_t* pstate, ast_node_t* rule, token_t* first, size_t post) {
+
+    parse_item_t item = { 0 };
+    item.rule = rule;
+    item.tokens = create_pointer_list();
+    item.start = first->offset;
+    item.end = get_token()->offset;
+    item.count = post_token_queue() - post;
+    item.line = first->line_no;
+    item.last_line = get_prev_token()->line_no;
+
+    ast_state_t state = { keep_tokens, NULL, item.tokens };
+    traverse_ast_node(rule, &state);
+
+    add_parse_item_list(pstate->tree->items, item);
+}
+
+/*
+ * The tokens of a moved item belong to both trees, so their lines are
+ * changed in place.
+ */
+static void move_item_lines(parse_item_t* item, int lines) {
+
+    int post = 0;
+    token_t* tok;
+
+    while(NULL != (tok = iterate_pointer_list(item->tokens, &post)))
+        tok->line_no += lines;
+}
+
+/*
+ * Move an item from the old tree to the new one. The items after the edit
+ * are moved by the change in the size of the text and in the number of
+ * lines. The tokens only need to be changed if the number of lines did.
+ */
+static void take_item(parser_state_t* pstate, parse_item_t* item, int lines) {
+
+    parse_edit_t* edit = pstate->edit;
+    parse_item_t copy = *item;
+
+    if(item->start >= edit->old_end) {
+        copy.start = item->start - edit->old_end + edit->new_end;
+        copy.end = item->end - edit->old_end + edit->new_end;
+        copy.line += lines;
+        copy.last_line += lines;
+        if(lines != 0)
+            move_item_lines(&copy, lines);
+    }
+
+    item->reused = true;
+    copy.reused = true;
+    add_parse_item_list(pstate->tree->items, copy);
+    pstate->tree->reused++;
+}
+
+/*
+ * Before anything is scanned, take the rules of the old tree that come
+ * before the edit and start scanning at a checkpoint. A checkpoint is the
+ * start of a rule that is the first thing on its line. Scanning never looks
+ * past the end of a line, so everything before the line that has the
+ * checkpoint scans the same way that it did before. Returns true if any
+ * rules were taken.
+ */
+static bool restart_at_checkpoint(parser_state_t* pstate) {
+
+    parse_item_list_t* items = pstate->old->items;
+    parse_edit_t* edit = pstate->edit;
+    int len = len_parse_item_list(items);
+    int idx = 0;
+
+    while(idx < len && items->list[idx].end < edit->start)
+        idx++;
+
+    if(idx >= len)
+        idx = len - 1;
+
+    while(idx > 0 && items->list[idx - 1].last_line >= items->list[idx].line)
+        idx--;
+
+    if(idx <= 0)
+        return false;
+
+    for(int i = 0; i < idx; i++)
+        take_item(pstate, &items->list[i], 0);
+
+    seek_scanner(items->list[idx].start, items->list[idx].line);
+    pstate->cursor = idx;
+    return true;
+}
+
+#define REUSE_NONE 0
+#define REUSE_ITEM 1
+#define REUSE_REST 2
+
+/*
+ * If the previous tree has a rule that the edit did not touch and that
+ * starts at the current token, then move it to the new tree and skip over
+ * its tokens. A rule before the edit is only taken if the tokens that are
+ * skipped end where the rule used to end, so the input was scanned the same
+ * way. Once the scanner gets to where a rule after the edit now starts, the
+ * rest of the input is the same as it was, so it would be scanned and parsed
+ * the same way, and all of the rest of the rules are taken without scanning
+ * them.
+ */
+static int reuse_item(parser_state_t* pstate) {
+
+    if(pstate->old == NULL)
+        return REUSE_NONE;
+
+    parse_item_list_t* items = pstate->old->items;
+    parse_edit_t* edit = pstate->edit;
+    size_t offset = get_token()->offset;
+
+    while(pstate->cursor < len_parse_item_list(items)) {
+        parse_item_t* item = &items->list[pstate->cursor];
+        size_t start, end;
+
+        if(item->end < edit->start) {
+            start = item->start;
+            end = item->end;
+        }
+        else if(item->start >= edit->old_end) {
+            start = item->start - edit->old_end + edit->new_end;
+            end = item->end - edit->old_end + edit->new_end;
+        }
+        else {
+            // damaged by the edit
+            pstate->cursor++;
+            continue;
+        }
+
+        if(start < offset) {
+            pstate->cursor++;
+            continue;
+        }
+        else if(start > offset)
+            return REUSE_NONE;
+
+        if(item->start >= edit->old_end) {
+            int lines = get_token()->line_no - item->line;
+            while(pstate->cursor < len_parse_item_list(items))
+                take_item(pstate, &items->list[pstate->cursor++], lines);
+            return REUSE_REST;
+        }
+
+        size_t post = post_token_queue();
+        for(size_t i = 0; i < item->count && get_token()->type != END_OF_INPUT; i++)
+            consume_token();
+
+        if(post_token_queue() - post != item->count || get_token()->offset != end) {
+            reset_token_queue(post);
+            return REUSE_NONE;
+        }
+
+        take_item(pstate, item, 0);
+        pstate->cursor++;
+        return REUSE_ITEM;
+    }
+
+    return REUSE_NONE;
+}
+
+/*
+ * grammar {
+ *    +(non_terminal_rule | terminal_rule) END_OF_INPUT
+ * }
+ *
+ * This is the same as parse_grammar() except that every rule is added to the
+ * parse tree as an item, and the rules of the previous tree that were not
+ * touched by the edit are used again instead of being parsed. The tokens of
+ * every rule are released once it is in the tree. Only the text from the
+ * checkpoint before the edit to the first rule after it that is found again
+ * is scanned.
+ */
+static ast_grammar_t* parse_grammar_tree(parser_state_t* pstate) {
+
+    ENTER;
+
+    assert(pstate != NULL);
+    ast_grammar_t* ptr = NULL;
+
+    int state = 100;
+    bool finished = false;
+
+    ast_node_t* rule = NULL;
+    token_t* first = NULL;
+    size_t post = 0;
+    int reuse;
+
+    if(pstate->old != NULL && restart_at_checkpoint(pstate))
+        state = 110;
+
+    while(!finished) {
+        switch(state) {
+            case 100:
+            case 110:
+                TRACE;
+                first = get_token();
+                post = post_token_queue();
+                if(REUSE_NONE != (reuse = reuse_item(pstate))) {
+                    release_tokens();
+                    state = (reuse == REUSE_REST) ? MATCH_STATE : 110;
+                }
+                else if(NULL != (rule = (ast_node_t*)parse_non_terminal_rule(pstate)) ||
+                        NULL != (rule = (ast_node_t*)parse_terminal_rule(pstate))) {
+                    add_item(pstate, rule, first, post);
+                    release_tokens();
+                    state = 110;
+                }
+                else if(state == 100) {
+                    PARSE_ERROR("grammar must contain at least one rule");
+                    state = ERROR_STATE;
+                }
+                else
+                    state = 120;
+                break;
+
+            case 120:
+                TRACE;
+                if(TTYPE == END_OF_INPUT) {
+                    consume_token();
+                    state = MATCH_STATE;
+                }
+                else {
+                    EXPECTED("end of input");
+                    state = ERROR_STATE;
+                }
+                break;
+
+            case MATCH_STATE: {
+                TRACE;
+                parse_item_list_t* items = pstate->tree->items;
+                ptr = (ast_grammar_t*)create_ast_node(AST_GRAMMAR);
+                ptr->rules = create_pointer_list();
+                for(int i = 0; i < len_parse_item_list(items); i++)
+                    add_pointer_list(ptr->rules, items->list[i].rule);
+                finished = true;
+            } break;
+
+            case ERROR_STATE:
+                TRACE;
+                finished = true;
+                break;
+
+            default:
+                fatal_error("unknown state in %s: %d\n", __func__, state);
+        }
+    }
+
+    RETURN(ptr);
+}
+
+/*
+ * Free a tree and the items in it, except for the items that were moved to
+ * a newer tree.
+ */
+static void free_parse_tree(parse_tree_t* tree) {
+
+    for(int i = 0; i < len_parse_item_list(tree->items); i++) {
+        if(!tree->items->list[i].reused)
+            destroy_item(&tree->items->list[i]);
+    }
+
+    if(tree->ast != NULL) {
+        destroy_pointer_list(tree->ast->rules);
+        _FREE(tree->ast);
+    }
+
+    destroy_parse_item_list(tree->items);
+    _FREE(tree);
+}
+
+/*
+ * A part of the input that starts at a top level rule and ends at the start
+ * of the next part. Every part is parsed on its own by the thread pool.
+ */
+typedef struct {
+    scanner_state_t* scanner;
+    size_t start;
+    size_t end;
+    pointer_list_t* rules;
+    bool ok;
+} parse_segment_t;
+
+DEFINE_VECTOR(parse_segment_list, parse_segment_t, 16)
+
+/*
+ * Split the tokens into about num parts. A part can only start where a top
+ * level rule can, which is a '~', a non-terminal or a terminal symbol that
+ * is not inside of brackets. The last part ends at the end of the input.
+ */
+static parse_segment_list_t* split_segments(int num) {
+
+    parse_segment_list_t* list = create_parse_segment_list();
+    size_t first = post_token_queue();
+    size_t start = first;
+    size_t size = 0;
+    int depth = 0;
+    token_type_t prev = END_OF_INPUT;
+
+    // find the size of a part
+    for(token_t* tok = get_token(); tok->type != END_OF_INPUT; tok = get_token()) {
+        consume_token();
+        size++;
+    }
+    size /= num;
+    reset_token_queue(first);
+
+    for(token_t* tok = get_token(); tok->type != END_OF_INPUT; tok = get_token()) {
+        size_t idx = post_token_queue();
+
+        switch(tok->type) {
+            case OCURLY:
+            case OPAREN:
+                depth++;
+                break;
+            case CCURLY:
+            case CPAREN:
+                if(depth > 0)
+                    depth--;
+                break;
+            case LAZY:
+            case NON_TERMINAL:
+            case TERMINAL_SYMBOL:
+                if(depth == 0 && prev != LAZY && idx - start > size) {
+                    add_parse_segment_list(list, (parse_segment_t){ get_scanner_state(), start, idx, NULL, false });
+                    start = idx;
+                }
+                break;
+            default:
+                break;
+        }
+
+        prev = tok->type;
+        consume_token();
+    }
+
+    add_parse_segment_list(list, (parse_segment_t){ get_scanner_state(), start, post_token_queue(), NULL, false });
+    reset_token_queue(first);
+
+    return list;
+}
+
+/*
+ * Parse the top level rules in a part. The errors are not reported here
+ * because a part that fails is parsed again in order with the rest of the
+ * input.
+ */
+static void parse_segment(parse_segment_t* seg) {
+
+    parser_state_t* pstate = _ALLOC_DS(parser_state_t);
+    ast_node_t* rule;
+
+    set_quiet_errors(true);
+    set_scanner_state(seg->scanner);
+    reset_token_queue(seg->start);
+
+    while(post_token_queue() < seg->end) {
+        if(NULL == (rule = (ast_node_t*)parse_non_terminal_rule(pstate)) &&
+                NULL == (rule = (ast_node_t*)parse_terminal_rule(pstate)))
+            break;
+        ADD_NODE(seg->rules, rule);
+    }
+
+    seg->ok = (post_token_queue() == seg->end && get_quiet_errors() == 0);
+
+    set_quiet_errors(false);
+    set_scanner_state(NULL);
+    _FREE(pstate);
+}
+
+/*
+ * Parse the parts of the input on the thread pool and join the rules that
+ * they found in order. If the input cannot be split or any of the parts did
+ * not parse on its own, then the whole input is parsed in order.
+ */
+static ast_grammar_t* parse_grammar_parallel(parser_state_t* pstate, int num_threads) {
+
+    ENTER;
+
+    // the shared node table and the allocators are not safe to use from
+    // more than one thread
+    if(get_ast_sharing() || get_allocator() != NULL)
+        RETURN(parse_grammar(pstate));
+
+    thread_pool_t* pool = create_thread_pool(num_threads);
+    parse_segment_list_t* list = split_segments(len_thread_pool(pool) * 4);
+    int len = len_parse_segment_list(list);
+    bool ok = (len > 1);
+
+    if(ok) {
+        for(int i = 0; i < len; i++)
+            add_thread_pool_task(pool, (thread_task_t)parse_segment, &list->list[i]);
+        wait_thread_pool(pool);
+    }
+    destroy_thread_pool(pool);
+
+    for(int i = 0; i < len; i++)
+        ok = ok && list->list[i].ok;
+
+    // a part that failed at its first rule has no list
+    pointer_list_t* rules = NULL;
+    for(int i = 0; i < len; i++) {
+        parse_segment_t* seg = &list->list[i];
+        if(seg->rules == NULL)
+            continue;
+
+        int post = 0;
+        ast_node_t* rule;
+        while(NULL != (rule = iterate_pointer_list(seg->rules, &post))) {
+            if(ok)
+                ADD_NODE(rules, rule);
+            else
+                destroy_ast(rule);
+        }
+        destroy_pointer_list(seg->rules);
+    }
+
+    ast_grammar_t* ptr = NULL;
+    if(ok && rules != NULL) {
+        reset_token_queue(list->list[len - 1].end);
+        consume_token();
+        ptr = (ast_grammar_t*)create_ast_node(AST_GRAMMAR);
+        ptr->rules = rules;
+    }
+    else {
+        // the rules from the parts were freed above
+        ptr = parse_grammar(pstate);
+    }
+
+    destroy_parse_segment_list(list);
+
+    RETURN(ptr);
+}
+
 /*
  * Set up the parser to run.
  */
@@ -885,3 +1810,173 @@ void* parse(const char* file_name) {
 
     FINISH(ptr);
 }
+
+/*
+ * Public interface to the parallel parser. The file is split at the top
+ * level rules and the parts are parsed on num_threads threads, or one per
+ * CPU if that is less than one.
+ */
+void* parse_parallel(const char* file_name, int num_threads) {
+
+    START;
+
+    assert(file_name != NULL);
+    void* ptr = parse_grammar_parallel(init_parser(file_name), num_threads);
+
+    FINISH(ptr);
+}
+
+/*
+ * Public interface to the lazy parser. The rule bodies are parsed when the
+ * rule elements are first asked for, so the scanner must not be closed
+ * until the AST is finished with. An error in a body is only reported when
+ * the body is parsed, so the caller has to check get_errors() after it is
+ * done with the AST.
+ */
+void* parse_lazy(const char* file_name) {
+
+    START;
+
+    assert(file_name != NULL);
+    parser_state_t* pstate = init_parser(file_name);
+    pstate->lazy = true;
+    void* ptr = parse_grammar(pstate);
+
+    FINISH(ptr);
+}
+
+/*
+ * Public interface to the streaming parser. The callback is called with
+ * every top level rule and the rule is freed when it returns.
+ */
+int parse_stream(const char* file_name, parse_callback_t callback, void* ctx) {
+
+    START;
+
+    assert(file_name != NULL);
+    assert(callback != NULL);
+
+    init_scanner_stream(file_name);
+    parser_state_t* pstate = _ALLOC_DS(parser_state_t);
+    pstate->callback = callback;
+    pstate->ctx = ctx;
+
+    int items = parse_grammar_stream(pstate);
+    _FREE(pstate);
+
+    FINISH(items);
+}
+
+/*
+ * Public interface to the event parser. No AST is built. The events for each
+ * top level rule are handed to the sink when the rule is complete. If the
+ * sink is NULL then the input is only checked. Returns true if the input is
+ * a valid grammar and no errors were reported.
+ */
+bool parse_events(const char* file_name, parse_sink_t* sink) {
+
+    START;
+
+    assert(file_name != NULL);
+
+    init_scanner_stream(file_name);
+    parser_state_t* pstate = _ALLOC_DS(parser_state_t);
+    pstate->events = true;
+    pstate->sink = sink;
+    pstate->log = (sink != NULL) ? create_event_list() : NULL;
+
+    // the parser goes on after most errors, so they are counted
+    int errors = get_errors();
+    bool valid = (parse_grammar(pstate) != NULL && get_errors() == errors);
+    if(valid)
+        commit_events(pstate);
+
+    destroy_event_list(pstate->log);
+    _FREE(pstate);
+
+    FINISH(valid);
+}
+
+/*
+ * Public interface to the incremental parser. Parse the file into a tree
+ * that can be given to reparse_tree() after the file is edited. Returns NULL
+ * if there was an error. The tree does not use the scanner, so the scanner
+ * is closed when this returns. Sharing must be turned off because the rules
+ * in a tree are freed separately.
+ */
+parse_tree_t* parse_tree(const char* file_name) {
+
+    return reparse_tree(NULL, file_name, NULL);
+}
+
+/*
+ * Parse the file again after an edit. The file must already have the new
+ * text. The rules in the old tree that the edit did not touch are moved to
+ * the new tree instead of being parsed, and the rest of the old tree is
+ * freed. If there was an error, then NULL is returned and the old tree is
+ * not changed. That includes the file not being there, which happens while
+ * an editor renames a new file over it.
+ */
+parse_tree_t* reparse_tree(parse_tree_t* tree, const char* file_name, parse_edit_t* edit) {
+
+    START;
+
+    assert(file_name != NULL);
+    assert(tree == NULL || edit != NULL);
+
+    if(!open_scanner_stream(file_name)) {
+        misc_error("cannot open input file: %s: %s", file_name, strerror(errno));
+        FINISH(NULL);
+    }
+    parser_state_t* pstate = _ALLOC_DS(parser_state_t);
+    pstate->old = tree;
+    pstate->edit = edit;
+    pstate->tree = _ALLOC_DS(parse_tree_t);
+    pstate->tree->items = create_parse_item_list();
+
+    // The items that were taken from the old tree are marked as reused in
+    // both trees until it is known which tree keeps them. The parser goes on
+    // after most errors, so the tree is only kept if none were reported.
+    int errors = get_errors();
+    parse_tree_t* ptr = pstate->tree;
+    ptr->ast = parse_grammar_tree(pstate);
+    if(ptr->ast != NULL && get_errors() == errors) {
+        if(tree != NULL)
+            free_parse_tree(tree);
+        for(int i = 0; i < len_parse_item_list(ptr->items); i++)
+            ptr->items->list[i].reused = false;
+    }
+    else {
+        // the items that were moved get back the lines of the old tree
+        if(tree != NULL) {
+            int old = 0;
+            for(int i = 0; i < len_parse_item_list(ptr->items); i++) {
+                parse_item_t* item = &ptr->items->list[i];
+                if(item->reused) {
+                    while(tree->items->list[old].tokens != item->tokens)
+                        old++;
+                    if(item->line != tree->items->list[old].line)
+                        move_item_lines(item, tree->items->list[old].line - item->line);
+                }
+            }
+            for(int i = 0; i < len_parse_item_list(tree->items); i++)
+                tree->items->list[i].reused = false;
+        }
+        free_parse_tree(ptr);
+        ptr = NULL;
+    }
+
+    uninit_scanner();
+    _FREE(pstate);
+
+    FINISH(ptr);
+}
+
+/*
+ * Free a tree and everything in it.
+ */
+void destroy_parse_tree(parse_tree_t* tree) {
+
+    if(tree != NULL)
+        free_parse_tree(tree);
+}
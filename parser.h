@@ -1,6 +1,11 @@
 #ifndef _PARSER_H_
 #define _PARSER_H_
 
+#include <stdbool.h>
+
+#include "ast.h"
+#include "scanner.h"
+
 /*
     grammar
     terminal_rule
@@ -13,10 +18,70 @@
     group_func
 */
 
+typedef void (*parse_callback_t)(void* item, void* ctx);
+
+/*
+ * Event sink for parse_events(). A rule is reported by enter() and exit()
+ * with the tokens that it consumed and the rules that it contains between
+ * them. Any of the functions can be NULL. The token is only valid for the
+ * duration of the call.
+ */
+typedef struct _parse_sink_t_ {
+    void (*enter)(ast_type_t type, void* ctx);
+    void (*exit)(ast_type_t type, void* ctx);
+    void (*token)(token_t* tok, void* ctx);
+    void* ctx;
+} parse_sink_t;
+
+/*
+ * An edit to the input of an incremental parse. The bytes from start to
+ * old_end in the old text were replaced by the bytes from start to new_end
+ * in the new text.
+ */
+typedef struct _parse_edit_t_ {
+    size_t start;
+    size_t old_end;
+    size_t new_end;
+} parse_edit_t;
+
+/*
+ * The result of an incremental parse. Every top level rule is kept with the
+ * span of the input that it was parsed from and its own copy of its tokens,
+ * so that a later parse can use it again if an edit does not touch it.
+ * Reused is the number of rules that were taken from the previous tree.
+ */
+typedef struct _parse_tree_t_ {
+    ast_grammar_t* ast;
+    struct _parse_item_list_t_* items;
+    int reused;
+} parse_tree_t;
+
 typedef struct _parser_state_ {
     int state; // dummy
+    parse_callback_t callback;
+    void* ctx;
+    bool events;
+    parse_sink_t* sink;
+    struct _event_list_t_* log;
+    parse_tree_t* tree;
+    parse_tree_t* old;
+    parse_edit_t* edit;
+    int cursor;
+    bool lazy;
+    // the shape of the last rule body, to check the lazy rules
+    int body_len;
+    bool body_opens;
+    bool body_closes;
 } parser_state_t;
 
 void* parse(const char* file_name);
+void* parse_lazy(const char* file_name);
+void* parse_parallel(const char* file_name, int num_threads);
+bool load_rule_body(ast_non_terminal_rule_t* nterm);
+int parse_stream(const char* file_name, parse_callback_t callback, void* ctx);
+bool parse_events(const char* file_name, parse_sink_t* sink);
+parse_tree_t* parse_tree(const char* file_name);
+parse_tree_t* reparse_tree(parse_tree_t* tree, const char* file_name, parse_edit_t* edit);
+void destroy_parse_tree(parse_tree_t* tree);
 
 #endif /* _PARSER_H_ */
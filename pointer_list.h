@@ -1,18 +1,12 @@
-
 #ifndef _POINTER_LIST_H_
 #define _POINTER_LIST_H_
 
-typedef struct {
-    void** list;
-    int cap;
-    int len;
-} pointer_list_t;
+#include "vector.h"
 
-pointer_list_t* create_pointer_list(void);
-void destroy_pointer_list(pointer_list_t*);
-void add_pointer_list(pointer_list_t*, void*);
-int len_pointer_list(pointer_list_t*);
-void* index_pointer_list(pointer_list_t*, int);
-void* iterate_pointer_list(pointer_list_t*, int*);
+/*
+ * Most of the lists in the AST hold one or two items, so the first four are
+ * kept in the list itself.
+ */
+DEFINE_VECTOR(pointer_list, void*, 4)
 
 #endif /* _POINTER_LIST_H_ */
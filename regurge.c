@@ -4,50 +4,57 @@
  * the AST is traversing correctly. It also serves as a template for AST pass
  * implementations.
  */
-#include <stdio.h>
-
 #include "ast.h"
+#include "ast_pass.h"
 #include "errors.h"
 #include "memory.h"
+#include "out_buffer.h"
 #include "regurge.h"
 
-static FILE* fh = NULL;
-
 /*
  * This function is entered before the node is traversed.
  */
-static void regurge_pre(ast_node_t* node) {
+static void regurge_pre(ast_node_t* node, void* state) {
+
+    out_buffer_t* buf = (out_buffer_t*)state;
 
     switch(node->type) {
         case AST_GRAMMAR:
             break;
-        case AST_NON_TERMINAL_RULE:
-            fprintf(fh, "%s {\n        ", ((ast_non_terminal_rule_t*)node)->nterm->text);
-            break;
+        case AST_NON_TERMINAL_RULE: {
+            ast_non_terminal_rule_t* nterm = (ast_non_terminal_rule_t*)node;
+            if(nterm->lazy)
+                add_out_char(buf, '~');
+            add_out_string(buf, nterm->nterm->text);
+            add_out_string(buf, " {\n        ");
+        } break;
         case AST_RULE_ELEMENT: {
             ast_rule_element_t* elem = (ast_rule_element_t*)node;
             if(elem->term != NULL) {
-                fprintf(fh, "%s ", elem->term->text ? elem->term->text : elem->term->name);
+                add_out_string(buf, elem->term->text ? elem->term->text : elem->term->name);
+                add_out_char(buf, ' ');
             }
         } break;
         case AST_TERMINAL_RULE:
-            fprintf(fh, "%s ", ((ast_terminal_rule_t*)node)->term_sym->text);
-            fprintf(fh, "%s\n\n", ((ast_terminal_rule_t*)node)->term_expr->text);
+            add_out_string(buf, ((ast_terminal_rule_t*)node)->term_sym->text);
+            add_out_char(buf, ' ');
+            add_out_string(buf, ((ast_terminal_rule_t*)node)->term_expr->text);
+            add_out_string(buf, "\n\n");
             break;
         case AST_ONE_OR_MORE_FUNC:
-            fprintf(fh, "+ ");
+            add_out_string(buf, "+ ");
             break;
         case AST_ZERO_OR_ONE_FUNC:
-            fprintf(fh, "? ");
+            add_out_string(buf, "? ");
             break;
         case AST_ZERO_OR_MORE_FUNC:
-            fprintf(fh, "* ");
+            add_out_string(buf, "* ");
             break;
         case AST_OR_FUNC:
-            fprintf(fh, "|\n        ");
+            add_out_string(buf, "|\n        ");
             break;
         case AST_GROUP_FUNC:
-            fprintf(fh, "( ");
+            add_out_string(buf, "( ");
             break;
         default:
             fatal_error("unknown state in %s", __func__);
@@ -57,14 +64,16 @@ static void regurge_pre(ast_node_t* node) {
 /*
  * This function is entered after the node is traversed.
  */
-static void regurge_post(ast_node_t* node) {
+static void regurge_post(ast_node_t* node, void* state) {
+
+    out_buffer_t* buf = (out_buffer_t*)state;
 
     switch(node->type) {
         case AST_NON_TERMINAL_RULE:
-            fprintf(fh, "\n    }\n\n");
+            add_out_string(buf, "\n    }\n\n");
             break;
         case AST_GROUP_FUNC:
-            fprintf(fh, ") ");
+            add_out_string(buf, ") ");
             break;
         case AST_GRAMMAR:
         case AST_TERMINAL_RULE:
@@ -80,17 +89,48 @@ static void regurge_post(ast_node_t* node) {
 }
 
 /*
- * Public interface
+ * Public interface. This can be given the grammar or any node below it. The
+ * output is added to the buffer.
  */
-void ast_regurge(void* ptr) {
+void ast_regurge(void* ptr, out_buffer_t* buf) {
 
     ast_state_t* state = _ALLOC_DS(ast_state_t);
     state->pre = (ast_callback_t)regurge_pre;
     state->post = (ast_callback_t)regurge_post;
+    state->state = buf;
 
-    fh = stdout;
-
-    traverse_ast(ptr, state);
+    traverse_ast_node(ptr, state);
 
     _FREE(state);
 }
+
+/*
+ * When the rules are regurged in parallel, every rule is written to its own
+ * buffer and the buffers are added to the output in the order of the rules.
+ */
+static void* regurge_create(void* state) {
+
+    (void)state;
+    return create_out_buffer();
+}
+
+static void regurge_merge(void* state, void* local) {
+
+    out_buffer_t* buf = (out_buffer_t*)local;
+
+    add_out_text((out_buffer_t*)state, buf->text, buf->len);
+    destroy_out_buffer(buf);
+}
+
+/*
+ * Register the pass so that it can be fused with other passes. The buffer is
+ * the state of the pass.
+ */
+ast_pass_t* add_regurge_pass(ast_pass_manager_t* mgr, out_buffer_t* buf) {
+
+    ast_pass_t* pass = add_pass(mgr, "regurge", (ast_callback_t)regurge_pre,
+                                (ast_callback_t)regurge_post, buf);
+    set_pass_parallel(pass, regurge_create, regurge_merge);
+
+    return pass;
+}
@@ -2,13 +2,16 @@
 #define _REGURGE_H_
 
 #include "ast.h"
+#include "ast_pass.h"
+#include "out_buffer.h"
 
 typedef ast_state_t regurge_state_t;
 
 /*
  * Public interface
  */
-void ast_regurge(void*);
+void ast_regurge(void* ptr, out_buffer_t* buf);
+ast_pass_t* add_regurge_pass(ast_pass_manager_t* mgr, out_buffer_t* buf);
 
 
 #endif /* _REGURGE_H_ */
@@ -1,6 +1,9 @@
 #ifndef _SCANNER_H_
 #define _SCANNER_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 typedef enum {
     // These tokens are part of the grammar.
     END_OF_INPUT,
@@ -12,6 +15,7 @@ typedef enum {
     CPAREN,
     OCURLY,
     CCURLY,
+    LAZY,
     NON_TERMINAL,
     TERMINAL_SYMBOL,
     TERMINAL_OPER,
@@ -25,15 +29,27 @@ typedef struct {
     const char* name;
     int line_no;
     int col_no;
+    size_t offset;
 } token_t;
 
+typedef struct _scanner_state_t_ scanner_state_t;
+
 void init_scanner(const char* file_name);
+void init_scanner_stream(const char* file_name);
+bool open_scanner_stream(const char* file_name);
 void uninit_scanner(void);
+scanner_state_t* get_scanner_state(void);
+void set_scanner_state(scanner_state_t* state);
 token_t* get_token(void);
 void add_token(token_type_t type, const char* str);
+void advance_scanner(size_t len);
 token_t* consume_token(void);
-int post_token_queue(void);
-void reset_token_queue(int post);
+token_t* get_prev_token(void);
+size_t post_token_queue(void);
+void reset_token_queue(size_t post);
+void release_tokens(void);
+void seek_scanner(size_t pos, int line_no);
+size_t match_bracket(size_t idx);
 const char* tok_to_str(token_t*);
 const char* tok_type_to_str(token_t*);
 const char* get_file_name(void);
@@ -1,24 +1,42 @@
 
 #include <ctype.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "memory.h"
 // #include "parser.h"
-#include "pointer_list.h"
 #include "scan.gen.h"
 #include "scanner.h"
-
-typedef pointer_list_t scanner_t;
-static scanner_t* scanner = NULL;
-static int crnt = 0;
-static const char* fname;
+#include "token_store.h"
+
+/*
+ * Everything that is known about the input that is being scanned. Every
+ * thread has its own so that separate files can be scanned and parsed at
+ * the same time.
+ */
+struct _scanner_state_t_ {
+    yyscan_t lexer;
+    FILE* fp;
+    token_store_t* tokens;
+    bool at_end;
+    char* fname;
+    size_t offset;
+    size_t token_offset;
+    size_t* brackets;
+    size_t num_brackets;
+};
+
+// A thread can be given the state of another to parse a separate part of
+// the same file, so the place in the tokens is kept apart from the state.
+static _Thread_local scanner_state_t* scanner = NULL;
+static _Thread_local size_t crnt = 0;
 
 static char* decorate_nterm(const char* str) {
 
     const char* finish = "_TOKEN";
-    static char tmp_buf[64];
+    static _Thread_local char tmp_buf[64];
     memset(tmp_buf, 0, sizeof(tmp_buf));
 
     for(int i = 0; str[i] != '\0'; i++) {
@@ -27,7 +45,7 @@ static char* decorate_nterm(const char* str) {
 
         if(i + strlen(finish) + 1 > sizeof(tmp_buf)) {
             fprintf(stderr, "FATAL: convert exceeds size of tmp_buf\n");
-            fprintf(stderr, "on line number %d\n", yylineno);
+            fprintf(stderr, "on line number %d\n", get_line_no());
             exit(1);
         }
     }
@@ -40,7 +58,7 @@ static char* decorate_nterm(const char* str) {
 static char* decorate_term_name(const char* str) {
 
     const char* finish = "_TOKEN";
-    static char tmp_buf[64];
+    static _Thread_local char tmp_buf[64];
     memset(tmp_buf, 0, sizeof(tmp_buf));
 
     for(int i = 1; str[i + 1] != '\0'; i++) {
@@ -49,7 +67,7 @@ static char* decorate_term_name(const char* str) {
 
         if(i + strlen(finish) + 1 > sizeof(tmp_buf)) {
             fprintf(stderr, "FATAL: convert exceeds size of tmp_buf\n");
-            fprintf(stderr, "on line number %d\n", yylineno);
+            fprintf(stderr, "on line number %d\n", get_line_no());
             exit(1);
         }
     }
@@ -62,7 +80,7 @@ static char* decorate_term_name(const char* str) {
 static char* decorate_term_oper(const char* str) {
 
     const char* finish = "TOKEN";
-    static char tmp_buf[64];
+    static _Thread_local char tmp_buf[64];
     memset(tmp_buf, 0, sizeof(tmp_buf));
 
     for(int i = 1; str[i + 1] != '\0'; i++) {
@@ -169,7 +187,7 @@ static char* decorate_term_oper(const char* str) {
 
         if(i + strlen(finish) + 1 > sizeof(tmp_buf)) {
             fprintf(stderr, "FATAL: convert exceeds size of tmp_buf\n");
-            fprintf(stderr, "on line number %d\n", yylineno);
+            fprintf(stderr, "on line number %d\n", get_line_no());
             exit(1);
         }
     }
@@ -181,8 +199,9 @@ static char* decorate_term_oper(const char* str) {
 
 void add_token(token_type_t type, const char* str) {
 
-    token_t* tok = _ALLOC_DS(token_t);
-    tok->line_no = yylineno;
+    token_t* tok = add_token_store(scanner->tokens);
+    tok->line_no = yyget_lineno(scanner->lexer);
+    tok->offset = scanner->token_offset;
     tok->type = type;
     tok->text = _COPY_STRING(str);
 
@@ -198,74 +217,217 @@ void add_token(token_type_t type, const char* str) {
     else
         // TERMINAL_SYMBOL
         tok->name = NULL;
+}
+
+/*
+ * Called by the scanner with the length of every match before its action is
+ * run, so the offset of the match is known when the token is added.
+ */
+void advance_scanner(size_t len) {
 
-    add_pointer_list(scanner, tok);
+    scanner->token_offset = scanner->offset;
+    scanner->offset += len;
 }
 
-void init_scanner(const char* file_name) {
+/*
+ * Scan until the token at idx exists or the end of the input is reached.
+ */
+static void fill_tokens(size_t idx) {
 
-    yyin = fopen(file_name, "r");
-    if(yyin == NULL) {
-        printf("cannot open input file: %s: %s\n", file_name, strerror(errno));
-        exit(1);
+    while(!scanner->at_end && idx >= len_token_store(scanner->tokens)) {
+        if(!yylex(scanner->lexer)) {
+            advance_scanner(0);
+            add_token(END_OF_INPUT, "end of input");
+            scanner->at_end = true;
+        }
     }
+}
+
+/*
+ * Open the file and scan it on demand as the parser asks for tokens. Return
+ * false if the file cannot be opened, with the reason in errno.
+ */
+bool open_scanner_stream(const char* file_name) {
+
+    FILE* fp = fopen(file_name, "r");
+    if(fp == NULL)
+        return false;
+
+    scanner = _ALLOC_DS(scanner_state_t);
+    scanner->fp = fp;
+    scanner->fname = _COPY_STRING(file_name);
+    scanner->tokens = create_token_store();
+    yylex_init(&scanner->lexer);
+    yyset_in(fp, scanner->lexer);
+    crnt = 0;
+
+    return true;
+}
 
-    fname = _COPY_STRING(file_name);
-    scanner = create_pointer_list();
+void init_scanner_stream(const char* file_name) {
 
-    while(yylex()) {
-        /* state driven execution */
-        // printf("%s\n", yytext);
+    if(!open_scanner_stream(file_name)) {
+        printf("cannot open input file: %s: %s\n", file_name, strerror(errno));
+        exit(1);
     }
+}
 
-    add_token(END_OF_INPUT, "end of input");
+void init_scanner(const char* file_name) {
 
-    // printf("%d tokens read\n", scanner->len);
+    init_scanner_stream(file_name);
+    fill_tokens((size_t)-1);
 
-    // printf("cap: %d\n", scanner->cap);
-    // printf("len: %d\n", scanner->len);
+    // printf("%lu tokens read\n", len_token_store(scanner->tokens));
 }
 
 void uninit_scanner(void) {
 
-    if(scanner != NULL) {
-        int idx = 0;
-        token_t* tok;
-        while(NULL != (tok = iterate_pointer_list(scanner, &idx))) {
-            _FREE(tok->text);
-            _FREE(tok->name);
-            _FREE(tok);
-        }
+    if(scanner == NULL)
+        return;
 
-        destroy_pointer_list(scanner);
-    }
+    fclose(scanner->fp);
+    yylex_destroy(scanner->lexer);
+
+    _FREE(scanner->brackets);
+    destroy_token_store(scanner->tokens);
+    _FREE(scanner->fname);
+    _FREE(scanner);
+    scanner = NULL;
+    crnt = 0;
+}
+
+/*
+ * The state of the scanner on this thread. Setting it lets another thread
+ * parse from the same tokens. The state is still owned by the thread that
+ * created it.
+ */
+scanner_state_t* get_scanner_state(void) {
+
+    return scanner;
+}
+
+void set_scanner_state(scanner_state_t* state) {
+
+    scanner = state;
+    crnt = 0;
 }
 
 token_t* get_token(void) {
 
-    return index_pointer_list(scanner, crnt);
+    if(crnt >= len_token_store(scanner->tokens))
+        fill_tokens(crnt);
+
+    return index_token_store(scanner->tokens, crnt);
 }
 
 token_t* consume_token(void) {
 
     // do not iterate past the end of the list to return NULL as
     // the iterator does.
-    if(crnt + 1 < scanner->len)
-        return iterate_pointer_list(scanner, &crnt);
+    if(crnt + 1 >= len_token_store(scanner->tokens))
+        fill_tokens(crnt + 1);
+
+    if(crnt + 1 < len_token_store(scanner->tokens))
+        return index_token_store(scanner->tokens, crnt++);
     else
         return get_token();
 }
 
-int post_token_queue(void) {
+/*
+ * Return the token before the current one, or NULL if it has been released.
+ */
+token_t* get_prev_token(void) {
+
+    return (crnt > 0) ? index_token_store(scanner->tokens, crnt - 1) : NULL;
+}
+
+size_t post_token_queue(void) {
 
     return crnt;
 }
 
-void reset_token_queue(int post) {
+void reset_token_queue(size_t post) {
 
     crnt = post;
 }
 
+/*
+ * Free the tokens before the current one. The parser must not reset to a
+ * position before this after calling it.
+ */
+void release_tokens(void) {
+
+    release_token_store(scanner->tokens, crnt);
+}
+
+/*
+ * Drop the current token and the ones after it, and scan again from the
+ * byte offset, which is on the line given. The scanner has no states, so
+ * scanning from the start of a line gives the same tokens as scanning to it
+ * did. This is used to skip over text that is known to scan the same way.
+ */
+void seek_scanner(size_t pos, int line_no) {
+
+    truncate_token_store(scanner->tokens, crnt);
+
+    if(fseek(scanner->fp, (long)pos, SEEK_SET) != 0) {
+        printf("cannot seek in input file: %s: %s\n", scanner->fname, strerror(errno));
+        exit(1);
+    }
+
+    yyrestart(scanner->fp, scanner->lexer);
+    yyset_lineno(line_no, scanner->lexer);
+    scanner->offset = pos;
+    scanner->token_offset = pos;
+    scanner->at_end = false;
+}
+
+/*
+ * Scan the whole input and record where every bracket is closed. A close
+ * bracket that does not match the last open one is ignored, so the open
+ * bracket is left without a match.
+ */
+static void index_brackets(void) {
+
+    fill_tokens((size_t)-1);
+
+    token_store_t* tokens = scanner->tokens;
+    size_t num = len_token_store(tokens);
+    size_t* brackets = _ALLOC_ARRAY(size_t, num);
+    size_t* stack = _ALLOC_ARRAY(size_t, num);
+    size_t top = 0;
+
+    for(size_t i = tokens->first; i < num; i++) {
+        token_type_t type = index_token_store(tokens, i)->type;
+
+        if(type == OCURLY || type == OPAREN)
+            stack[top++] = i;
+        else if(type == CCURLY || type == CPAREN) {
+            token_type_t open = (type == CCURLY) ? OCURLY : OPAREN;
+            if(top > 0 && index_token_store(tokens, stack[top - 1])->type == open)
+                brackets[stack[--top]] = i;
+        }
+    }
+
+    scanner->brackets = brackets;
+    scanner->num_brackets = num;
+
+    _FREE(stack);
+}
+
+/*
+ * Return the position of the token that closes the bracket at idx, or 0 if
+ * it is not an open bracket or it is not closed. The index is built the
+ * first time that it is used.
+ */
+size_t match_bracket(size_t idx) {
+
+    if(scanner->brackets == NULL)
+        index_brackets();
+
+    return (idx < scanner->num_brackets) ? scanner->brackets[idx] : 0;
+}
+
 const char* tok_type_to_str(token_t* tok) {
 
     return (tok->type == END_OF_INPUT)     ? "END_OF_INPUT" :
@@ -277,6 +439,7 @@ const char* tok_type_to_str(token_t* tok) {
             (tok->type == CPAREN)          ? "CPAREN" :
             (tok->type == OCURLY)          ? "OCURLY" :
             (tok->type == CCURLY)          ? "CCURLY" :
+            (tok->type == LAZY)            ? "LAZY" :
             (tok->type == NON_TERMINAL)    ? "NON_TERMINAL" :
             (tok->type == TERMINAL_SYMBOL) ? "TERMINAL_SYMBOL" :
             (tok->type == TERMINAL_NAME)   ? "TERMINAL_NAME" :
@@ -291,9 +454,9 @@ const char* tok_to_str(token_t* tok) {
 }
 
 int get_line_no(void) {
-    return yylineno;
+    return (scanner != NULL) ? yyget_lineno(scanner->lexer) : 0;
 }
 
 const char* get_file_name(void) {
-    return fname;
+    return (scanner != NULL) ? scanner->fname : NULL;
 }
@@ -0,0 +1,132 @@
+/*
+ * Compile and render the templates of the emitters. A template is parsed
+ * into ops one time and after that, rendering a template is a run over the
+ * ops that appends to the buffer. There is no parsing or formatting of the
+ * template text when the output is made.
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "errors.h"
+#include "memory.h"
+#include "out_buffer.h"
+#include "template.h"
+
+// the nesting of the conditional text
+#define MAX_DEPTH 16
+
+static int find_slot(const char* name, size_t len, const char** slots, int num_slots) {
+
+    for(int i = 0; i < num_slots; i++) {
+        if(strlen(slots[i]) == len && !strncmp(slots[i], name, len))
+            return i;
+    }
+
+    fatal_error("unknown template slot: %.*s", (int)len, name);
+    return -1;
+}
+
+static void add_op(template_t* tmpl, template_op_type_t type, const char* text, size_t len, int slot) {
+
+    template_op_t op = { type, text, len, slot, 0 };
+    add_template_op_list(&tmpl->ops, op);
+}
+
+/*
+ * A template that is not correct is an error in the program, so it is
+ * fatal.
+ */
+template_t* compile_template(const char* text, const char** slots, int num_slots) {
+
+    assert(text != NULL);
+    assert(slots != NULL);
+
+    template_t* tmpl = _ALLOC_DS(template_t);
+    init_template_op_list(&tmpl->ops);
+
+    int stack[MAX_DEPTH];
+    int depth = 0;
+    const char* start = text;
+    const char* ptr = text;
+
+    while(*ptr != '\0') {
+        if(ptr[0] != '$' || ptr[1] != '{') {
+            ptr++;
+            continue;
+        }
+
+        if(ptr > start)
+            add_op(tmpl, TEMPLATE_TEXT, start, ptr - start, 0);
+
+        ptr += 2;
+        const char* end = strchr(ptr, '}');
+        if(end == NULL)
+            fatal_error("template slot is not closed: %s", ptr - 2);
+
+        if(*ptr == '?') {
+            if(depth == MAX_DEPTH)
+                fatal_error("template conditions are nested too deep");
+            stack[depth++] = tmpl->ops.len;
+            add_op(tmpl, TEMPLATE_IF, NULL, 0, find_slot(ptr + 1, end - ptr - 1, slots, num_slots));
+        }
+        else if(*ptr == '/') {
+            int slot = find_slot(ptr + 1, end - ptr - 1, slots, num_slots);
+            if(depth == 0 || tmpl->ops.list[stack[depth - 1]].slot != slot)
+                fatal_error("template condition is not open: %.*s", (int)(end - ptr - 1), ptr + 1);
+            tmpl->ops.list[stack[--depth]].jump = tmpl->ops.len;
+        }
+        else
+            add_op(tmpl, TEMPLATE_SLOT, NULL, 0, find_slot(ptr, end - ptr, slots, num_slots));
+
+        ptr = start = end + 1;
+    }
+
+    if(ptr > start)
+        add_op(tmpl, TEMPLATE_TEXT, start, ptr - start, 0);
+
+    if(depth != 0)
+        fatal_error("template condition is not closed: %s", slots[tmpl->ops.list[stack[depth - 1]].slot]);
+
+    return tmpl;
+}
+
+void destroy_template(template_t* tmpl) {
+
+    if(tmpl != NULL) {
+        uninit_template_op_list(&tmpl->ops);
+        _FREE(tmpl);
+    }
+}
+
+void render_template(out_buffer_t* buf, template_t* tmpl, template_value_t* values) {
+
+    assert(buf != NULL);
+    assert(tmpl != NULL);
+
+    template_op_t* ops = tmpl->ops.list;
+    int len = tmpl->ops.len;
+
+    for(int i = 0; i < len; i++) {
+        template_value_t* val;
+
+        switch(ops[i].type) {
+            case TEMPLATE_TEXT:
+                add_out_text(buf, ops[i].text, ops[i].len);
+                break;
+            case TEMPLATE_SLOT:
+                val = &values[ops[i].slot];
+                if(val->text != NULL)
+                    add_out_text(buf, val->text, val->len);
+                else
+                    add_out_int(buf, val->num);
+                break;
+            case TEMPLATE_IF:
+                val = &values[ops[i].slot];
+                if((val->text != NULL) ? val->len == 0 : val->num == 0)
+                    i = ops[i].jump - 1;
+                break;
+            default:
+                fatal_error("unknown template op in %s: %d", __func__, ops[i].type);
+        }
+    }
+}
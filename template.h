@@ -0,0 +1,77 @@
+#ifndef _TEMPLATE_H_
+#define _TEMPLATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "out_buffer.h"
+#include "vector.h"
+
+/*
+ * A template is text with slots in it. "${name}" is replaced with the value
+ * of the slot and the text between "${?name}" and "${/name}" is only used if
+ * the value of the slot is not empty or zero. The names are given when the
+ * template is compiled and the values are given in the same order when it is
+ * rendered.
+ *
+ * A template is compiled once into a list of ops that point into the text,
+ * so the text must not be freed while the template is used. Rendering only
+ * appends the spans and the values to the buffer. A compiled template is
+ * not changed by rendering, so it can be rendered on several threads.
+ */
+typedef enum {
+    TEMPLATE_TEXT,
+    TEMPLATE_SLOT,
+    TEMPLATE_IF,
+} template_op_type_t;
+
+// an if op goes to jump when its slot is empty
+typedef struct {
+    template_op_type_t type;
+    const char* text;
+    size_t len;
+    int slot;
+    int jump;
+} template_op_t;
+
+DEFINE_VECTOR(template_op_list, template_op_t, 16)
+
+typedef struct _template_t_ {
+    template_op_list_t ops;
+} template_t;
+
+/*
+ * The value of a slot is text, or a number when text is NULL.
+ */
+typedef struct {
+    const char* text;
+    size_t len;
+    long num;
+} template_value_t;
+
+template_t* compile_template(const char* text, const char** slots, int num_slots);
+void destroy_template(template_t* tmpl);
+void render_template(out_buffer_t* buf, template_t* tmpl, template_value_t* values);
+
+static inline template_value_t template_string(const char* str) {
+
+    return (template_value_t){ str, strlen(str), 0 };
+}
+
+static inline template_value_t template_buffer(out_buffer_t* buf) {
+
+    return (template_value_t){ buf->text, buf->len, 0 };
+}
+
+static inline template_value_t template_int(long num) {
+
+    return (template_value_t){ NULL, 0, num };
+}
+
+static inline template_value_t template_bool(bool flag) {
+
+    return (template_value_t){ NULL, 0, flag };
+}
+
+#endif /* _TEMPLATE_H_ */
@@ -0,0 +1,274 @@
+/*
+ * Work stealing thread pool. Every worker has its own queue of tasks. Tasks
+ * that are added from outside of the pool are dealt out to the queues in
+ * turn and tasks that are added by a running task go on the queue of the
+ * worker that runs it. A worker takes the newest task from its own queue and
+ * when that is empty, it steals the oldest task from the other queues.
+ *
+ * The wait function must not be called from inside of a task because the
+ * task that is waiting is counted as pending.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include "errors.h"
+#include "memory.h"
+#include "thread_pool.h"
+
+typedef struct {
+    thread_task_t task;
+    void* arg;
+} task_t;
+
+typedef struct {
+    task_t* list;
+    int cap;
+    int head;
+    int len;
+    mtx_t lock;
+} task_queue_t;
+
+typedef struct {
+    thread_pool_t* pool;
+    int idx;
+} worker_t;
+
+struct _thread_pool_t_ {
+    thrd_t* threads;
+    worker_t* workers;
+    task_queue_t* queues;
+    int num;
+    int next;
+    int pending;
+    atomic_int queued;
+    bool stop;
+    mtx_t lock;
+    cnd_t work;
+    cnd_t done;
+};
+
+static _Thread_local worker_t* this_worker = NULL;
+
+static void push_queue(task_queue_t* queue, task_t task) {
+
+    mtx_lock(&queue->lock);
+
+    if(queue->len + 1 > queue->cap) {
+        task_t* list = _ALLOC_ARRAY(task_t, queue->cap << 1);
+        for(int i = 0; i < queue->len; i++)
+            list[i] = queue->list[(queue->head + i) % queue->cap];
+        _FREE(queue->list);
+        queue->list = list;
+        queue->cap <<= 1;
+        queue->head = 0;
+    }
+
+    queue->list[(queue->head + queue->len) % queue->cap] = task;
+    queue->len++;
+
+    mtx_unlock(&queue->lock);
+}
+
+/*
+ * The owner takes from the tail.
+ */
+static bool pop_queue(task_queue_t* queue, task_t* task) {
+
+    bool found = false;
+
+    mtx_lock(&queue->lock);
+    if(queue->len > 0) {
+        queue->len--;
+        *task = queue->list[(queue->head + queue->len) % queue->cap];
+        found = true;
+    }
+    mtx_unlock(&queue->lock);
+
+    return found;
+}
+
+/*
+ * Thieves take from the head.
+ */
+static bool steal_queue(task_queue_t* queue, task_t* task) {
+
+    bool found = false;
+
+    mtx_lock(&queue->lock);
+    if(queue->len > 0) {
+        *task = queue->list[queue->head];
+        queue->head = (queue->head + 1) % queue->cap;
+        queue->len--;
+        found = true;
+    }
+    mtx_unlock(&queue->lock);
+
+    return found;
+}
+
+static bool find_task(worker_t* worker, task_t* task) {
+
+    thread_pool_t* pool = worker->pool;
+
+    if(pop_queue(&pool->queues[worker->idx], task))
+        return true;
+
+    for(int i = 1; i < pool->num; i++) {
+        if(steal_queue(&pool->queues[(worker->idx + i) % pool->num], task))
+            return true;
+    }
+
+    return false;
+}
+
+static int worker_main(void* arg) {
+
+    worker_t* worker = (worker_t*)arg;
+    thread_pool_t* pool = worker->pool;
+    task_t task;
+
+    this_worker = worker;
+
+    while(true) {
+        if(find_task(worker, &task)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            (*task.task)(task.arg);
+
+            mtx_lock(&pool->lock);
+            pool->pending--;
+            if(pool->pending == 0)
+                cnd_broadcast(&pool->done);
+            mtx_unlock(&pool->lock);
+        }
+        else {
+            mtx_lock(&pool->lock);
+            while(atomic_load(&pool->queued) <= 0 && !pool->stop)
+                cnd_wait(&pool->work, &pool->lock);
+            bool finished = pool->stop && atomic_load(&pool->queued) <= 0;
+            mtx_unlock(&pool->lock);
+
+            if(finished)
+                break;
+        }
+    }
+
+    return 0;
+}
+
+thread_pool_t* create_thread_pool(int num) {
+
+    if(num < 1)
+        num = get_num_cpus();
+
+    thread_pool_t* ptr = _ALLOC_DS(thread_pool_t);
+    ptr->num = num;
+    ptr->threads = _ALLOC_ARRAY(thrd_t, num);
+    ptr->workers = _ALLOC_ARRAY(worker_t, num);
+    ptr->queues = _ALLOC_ARRAY(task_queue_t, num);
+    atomic_init(&ptr->queued, 0);
+
+    mtx_init(&ptr->lock, mtx_plain);
+    cnd_init(&ptr->work);
+    cnd_init(&ptr->done);
+
+    for(int i = 0; i < num; i++) {
+        ptr->queues[i].cap = 1 << 3;
+        ptr->queues[i].list = _ALLOC_ARRAY(task_t, ptr->queues[i].cap);
+        mtx_init(&ptr->queues[i].lock, mtx_plain);
+    }
+
+    for(int i = 0; i < num; i++) {
+        ptr->workers[i].pool = ptr;
+        ptr->workers[i].idx = i;
+        if(thrd_create(&ptr->threads[i], worker_main, &ptr->workers[i]) != thrd_success)
+            fatal_error("cannot create worker thread %d", i);
+    }
+
+    return ptr;
+}
+
+void destroy_thread_pool(thread_pool_t* pool) {
+
+    if(pool != NULL) {
+        mtx_lock(&pool->lock);
+        pool->stop = true;
+        cnd_broadcast(&pool->work);
+        mtx_unlock(&pool->lock);
+
+        for(int i = 0; i < pool->num; i++)
+            thrd_join(pool->threads[i], NULL);
+
+        for(int i = 0; i < pool->num; i++) {
+            mtx_destroy(&pool->queues[i].lock);
+            _FREE(pool->queues[i].list);
+        }
+
+        cnd_destroy(&pool->done);
+        cnd_destroy(&pool->work);
+        mtx_destroy(&pool->lock);
+
+        _FREE(pool->queues);
+        _FREE(pool->workers);
+        _FREE(pool->threads);
+        _FREE(pool);
+    }
+}
+
+void add_thread_pool_task(thread_pool_t* pool, thread_task_t task, void* arg) {
+
+    assert(pool != NULL);
+    assert(task != NULL);
+
+    task_t tsk = { task, arg };
+    int idx;
+
+    mtx_lock(&pool->lock);
+    pool->pending++;
+    if(this_worker != NULL && this_worker->pool == pool)
+        idx = this_worker->idx;
+    else {
+        idx = pool->next;
+        pool->next = (pool->next + 1) % pool->num;
+    }
+    mtx_unlock(&pool->lock);
+
+    push_queue(&pool->queues[idx], tsk);
+
+    mtx_lock(&pool->lock);
+    atomic_fetch_add(&pool->queued, 1);
+    cnd_signal(&pool->work);
+    mtx_unlock(&pool->lock);
+}
+
+/*
+ * Block until every task that was added has finished.
+ */
+void wait_thread_pool(thread_pool_t* pool) {
+
+    assert(pool != NULL);
+    assert(this_worker == NULL || this_worker->pool != pool);
+
+    mtx_lock(&pool->lock);
+    while(pool->pending > 0)
+        cnd_wait(&pool->done, &pool->lock);
+    mtx_unlock(&pool->lock);
+}
+
+int len_thread_pool(thread_pool_t* pool) {
+
+    return pool->num;
+}
+
+int get_num_cpus(void) {
+
+    long num = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (num < 1) ? 1 : (int)num;
+}
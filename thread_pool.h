@@ -0,0 +1,14 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+typedef void (*thread_task_t)(void*);
+typedef struct _thread_pool_t_ thread_pool_t;
+
+thread_pool_t* create_thread_pool(int num);
+void destroy_thread_pool(thread_pool_t* pool);
+void add_thread_pool_task(thread_pool_t* pool, thread_task_t task, void* arg);
+void wait_thread_pool(thread_pool_t* pool);
+int len_thread_pool(thread_pool_t* pool);
+int get_num_cpus(void);
+
+#endif /* _THREAD_POOL_H_ */
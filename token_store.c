@@ -0,0 +1,126 @@
+/*
+ * Segmented token storage. The scanner produces one token per symbol in the
+ * input, so this can hold more tokens than will fit in an int and grows
+ * without copying the tokens.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "scanner.h"
+#include "token_store.h"
+
+token_store_t* create_token_store(void) {
+
+    token_store_t* ptr = _ALLOC_DS(token_store_t);
+    ptr->cap = 1 << 3;
+    ptr->base = 0;
+    ptr->first = 0;
+    ptr->len = 0;
+    ptr->chunks = _ALLOC_ARRAY(token_t*, ptr->cap);
+
+    return ptr;
+}
+
+/*
+ * The store owns the tokens and the strings in them.
+ */
+void destroy_token_store(token_store_t* store) {
+
+    if(store != NULL) {
+        release_token_store(store, store->len);
+
+        // only the chunk that holds the end of the store is left
+        if((store->len & TOKEN_CHUNK_MASK) != 0)
+            _FREE(store->chunks[0]);
+
+        _FREE(store->chunks);
+        _FREE(store);
+    }
+}
+
+/*
+ * Return a new zeroed token at the end of the store.
+ */
+token_t* add_token_store(token_store_t* store) {
+
+    assert(store != NULL);
+
+    size_t chunk = (store->len >> TOKEN_CHUNK_BITS) - store->base;
+
+    if((store->len & TOKEN_CHUNK_MASK) == 0) {
+        if(chunk + 1 > store->cap) {
+            store->cap <<= 1;
+            store->chunks = _REALLOC_ARRAY(store->chunks, token_t*, store->cap);
+        }
+        store->chunks[chunk] = _ALLOC_ARRAY(token_t, TOKEN_CHUNK_SIZE);
+    }
+
+    token_t* tok = &store->chunks[chunk][store->len & TOKEN_CHUNK_MASK];
+    store->len++;
+
+    return tok;
+}
+
+/*
+ * Release all of the tokens before idx. The chunks that hold only released
+ * tokens are freed. The chunk that holds idx is kept.
+ */
+void release_token_store(token_store_t* store, size_t idx) {
+
+    assert(store != NULL);
+
+    if(idx > store->len)
+        idx = store->len;
+
+    for(size_t i = store->first; i < idx; i++) {
+        token_t* tok = index_token_store(store, i);
+        _FREE(tok->text);
+        _FREE(tok->name);
+        tok->text = NULL;
+        tok->name = NULL;
+    }
+
+    if(idx > store->first)
+        store->first = idx;
+
+    size_t num = (idx >> TOKEN_CHUNK_BITS) - store->base;
+    if(num > 0) {
+        size_t live = ((store->len + TOKEN_CHUNK_MASK) >> TOKEN_CHUNK_BITS) - store->base;
+
+        for(size_t i = 0; i < num; i++)
+            _FREE(store->chunks[i]);
+
+        memmove(store->chunks, &store->chunks[num], (live - num) * sizeof(token_t*));
+        store->base += num;
+    }
+}
+
+/*
+ * Free the tokens from idx to the end of the store. The chunks that hold
+ * only those tokens are freed.
+ */
+void truncate_token_store(token_store_t* store, size_t idx) {
+
+    assert(store != NULL);
+    assert(idx >= store->first);
+
+    if(idx >= store->len)
+        return;
+
+    for(size_t i = idx; i < store->len; i++) {
+        token_t* tok = index_token_store(store, i);
+        _FREE(tok->text);
+        _FREE(tok->name);
+    }
+
+    size_t keep = ((idx + TOKEN_CHUNK_MASK) >> TOKEN_CHUNK_BITS) - store->base;
+    size_t live = ((store->len + TOKEN_CHUNK_MASK) >> TOKEN_CHUNK_BITS) - store->base;
+
+    for(size_t i = keep; i < live; i++)
+        _FREE(store->chunks[i]);
+
+    store->len = idx;
+}
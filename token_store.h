@@ -0,0 +1,50 @@
+#ifndef _TOKEN_STORE_H_
+#define _TOKEN_STORE_H_
+
+#include <stddef.h>
+
+#include "scanner.h"
+
+/*
+ * Tokens are stored in fixed size chunks. A token never moves once it has
+ * been added, and adding a token never copies the tokens that are already
+ * stored. Only the table of chunk pointers is grown.
+ *
+ * Tokens at the front of the store can be released when they are no longer
+ * needed. Their chunks are freed and the table is shifted down, so a store
+ * that is released as it goes uses memory for the tokens that are live
+ * rather than for all of the tokens that were ever added. Positions are not
+ * changed by releasing.
+ */
+#define TOKEN_CHUNK_BITS 12
+#define TOKEN_CHUNK_SIZE ((size_t)1 << TOKEN_CHUNK_BITS)
+#define TOKEN_CHUNK_MASK (TOKEN_CHUNK_SIZE - 1)
+
+typedef struct _token_store_t_ {
+    token_t** chunks;
+    size_t cap;
+    size_t base;
+    size_t first;
+    size_t len;
+} token_store_t;
+
+token_store_t* create_token_store(void);
+void destroy_token_store(token_store_t* store);
+token_t* add_token_store(token_store_t* store);
+void release_token_store(token_store_t* store, size_t idx);
+void truncate_token_store(token_store_t* store, size_t idx);
+
+static inline size_t len_token_store(token_store_t* store) {
+
+    return store->len;
+}
+
+static inline token_t* index_token_store(token_store_t* store, size_t idx) {
+
+    if(idx < store->len && idx >= store->first)
+        return &store->chunks[(idx >> TOKEN_CHUNK_BITS) - store->base][idx & TOKEN_CHUNK_MASK];
+    else
+        return NULL;
+}
+
+#endif /* _TOKEN_STORE_H_ */
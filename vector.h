@@ -0,0 +1,101 @@
+#ifndef _VECTOR_H_
+#define _VECTOR_H_
+
+#include <assert.h>
+#include <string.h>
+
+#include "memory.h"
+
+/*
+ * Type generic vector. DEFINE_VECTOR(name, type, n) defines the type name_t
+ * and the inline functions to manage it. The first n items are kept in the
+ * data structure itself, so a short list needs no memory other than the data
+ * structure. When the list outgrows that, the items are moved to the heap and
+ * the list grows by doubling.
+ *
+ * The list pointer points into the data structure, so a vector must not be
+ * copied once it has been initialized.
+ *
+ * create_name()        allocate and initialize a vector
+ * destroy_name(v)      free the items and the vector
+ * init_name(v)         initialize a vector that is in other memory
+ * uninit_name(v)       free the items of a vector that is in other memory
+ * add_name(v, item)    append an item
+ * len_name(v)          the number of items
+ * index_name(v, idx)   the item at idx, or zero if idx is out of range
+ * iterate_name(v, &m)  the item at m and advance m, or zero at the end
+ * truncate_name(v, n)  drop the items after the first n
+ */
+#define DEFINE_VECTOR(name, type, n)                                               \
+    typedef struct _##name##_t_ {                                                  \
+        type* list;                                                                \
+        int cap;                                                                   \
+        int len;                                                                   \
+        type local[n];                                                             \
+    } name##_t;                                                                    \
+                                                                                   \
+    static inline void init_##name(name##_t* vec) {                                \
+        vec->list = vec->local;                                                    \
+        vec->cap = (n);                                                            \
+        vec->len = 0;                                                              \
+    }                                                                              \
+                                                                                   \
+    static inline void uninit_##name(name##_t* vec) {                              \
+        if(vec->list != vec->local)                                                \
+            _FREE(vec->list);                                                      \
+        vec->list = vec->local;                                                    \
+        vec->cap = (n);                                                            \
+        vec->len = 0;                                                              \
+    }                                                                              \
+                                                                                   \
+    static inline name##_t* create_##name(void) {                                  \
+        name##_t* vec = _ALLOC_DS(name##_t);                                       \
+        init_##name(vec);                                                          \
+        return vec;                                                                \
+    }                                                                              \
+                                                                                   \
+    static inline void destroy_##name(name##_t* vec) {                             \
+        if(vec != NULL) {                                                          \
+            uninit_##name(vec);                                                    \
+            _FREE(vec);                                                            \
+        }                                                                          \
+    }                                                                              \
+                                                                                   \
+    static inline void grow_##name(name##_t* vec) {                                \
+        if(vec->list == vec->local) {                                              \
+            vec->list = _ALLOC_ARRAY(type, vec->cap << 1);                         \
+            memcpy(vec->list, vec->local, sizeof(type) * vec->len);                \
+        }                                                                          \
+        else                                                                       \
+            vec->list = _REALLOC_ARRAY(vec->list, type, vec->cap << 1);            \
+        vec->cap <<= 1;                                                            \
+    }                                                                              \
+                                                                                   \
+    static inline void add_##name(name##_t* vec, type item) {                      \
+        if(vec->len + 1 > vec->cap)                                                \
+            grow_##name(vec);                                                      \
+        vec->list[vec->len] = item;                                                \
+        vec->len++;                                                                \
+    }                                                                              \
+                                                                                   \
+    static inline int len_##name(name##_t* vec) {                                  \
+        return vec->len;                                                           \
+    }                                                                              \
+                                                                                   \
+    static inline type index_##name(name##_t* vec, int idx) {                      \
+        return ((unsigned)idx < (unsigned)vec->len) ? vec->list[idx] : (type){ 0 }; \
+    }                                                                              \
+                                                                                   \
+    static inline type iterate_##name(name##_t* vec, int* mark) {                  \
+        if((unsigned)*mark < (unsigned)vec->len)                                   \
+            return vec->list[(*mark)++];                                           \
+        return (type){ 0 };                                                        \
+    }                                                                              \
+                                                                                   \
+    static inline void truncate_##name(name##_t* vec, int len) {                   \
+        assert(len >= 0);                                                          \
+        if(len < vec->len)                                                         \
+            vec->len = len;                                                        \
+    }
+
+#endif /* _VECTOR_H_ */
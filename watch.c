@@ -0,0 +1,205 @@
+/*
+ * Watch mode. The grammar is parsed once and then again every time that the
+ * file is saved. The edit is found by comparing the new text with the text
+ * that the tree was parsed from, so only the rules that the edit touched are
+ * parsed again. The directory is watched rather than the file because most
+ * editors save by writing a new file and renaming it over the old one.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "errors.h"
+#include "memory.h"
+#include "parser.h"
+#include "watch.h"
+
+// #define TRACE_WATCH
+
+typedef struct {
+    char* text;
+    size_t len;
+} watch_text_t;
+
+static double get_time(void) {
+
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Read the whole file. Return false if it cannot be read, which happens
+ * while an editor is replacing it.
+ */
+static bool read_text(const char* file_name, watch_text_t* ptr) {
+
+    FILE* fp = fopen(file_name, "rb");
+    if(fp == NULL)
+        return false;
+
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    rewind(fp);
+
+    ptr->text = _ALLOC(len + 1);
+    ptr->len = fread(ptr->text, 1, len, fp);
+    fclose(fp);
+
+    return true;
+}
+
+/*
+ * The edit that turns the old text into the new one. It covers everything
+ * from the first byte that is different to the last one.
+ */
+static parse_edit_t find_edit(watch_text_t* old, watch_text_t* text) {
+
+    size_t max = (old->len < text->len) ? old->len : text->len;
+    size_t head = 0;
+    size_t tail = 0;
+
+    while(head < max && old->text[head] == text->text[head])
+        head++;
+
+    while(tail < max - head && old->text[old->len - tail - 1] == text->text[text->len - tail - 1])
+        tail++;
+
+    return (parse_edit_t){ head, old->len - tail, text->len - tail };
+}
+
+static bool same_text(watch_text_t* left, watch_text_t* right) {
+
+    return left->len == right->len && !memcmp(left->text, right->text, left->len);
+}
+
+/*
+ * Parse the file again. The tree is replaced when the parse works and is
+ * kept with its text when it does not, so that the next edit is found from
+ * the last text that parsed.
+ */
+static void update_tree(const char* file_name, parse_tree_t** tree, watch_text_t* text,
+                        watch_callback_t callback, void* ctx) {
+
+    watch_text_t next;
+    if(!read_text(file_name, &next))
+        return;
+
+    if(*tree != NULL && same_text(text, &next)) {
+        _FREE(next.text);
+        return;
+    }
+
+    double start = get_time();
+    parse_tree_t* ptr;
+
+    if(*tree == NULL)
+        ptr = parse_tree(file_name);
+    else {
+        parse_edit_t edit = find_edit(text, &next);
+        ptr = reparse_tree(*tree, file_name, &edit);
+        // the old tree was freed by the parse
+        if(ptr != NULL)
+            *tree = NULL;
+    }
+
+    // If the file was saved again while it was parsed, then the tree might
+    // not be from the text that was read, so it is parsed from scratch.
+    if(ptr != NULL) {
+        watch_text_t check = { NULL, 0 };
+        bool same = read_text(file_name, &check) && same_text(&next, &check);
+        _FREE(check.text);
+
+        if(!same) {
+            destroy_parse_tree(ptr);
+            _FREE(next.text);
+            _FREE(text->text);
+            *text = (watch_text_t){ NULL, 0 };
+            update_tree(file_name, tree, text, callback, ctx);
+            return;
+        }
+    }
+
+    if(ptr == NULL) {
+        fprintf(stderr, "%s: not changed because of errors\n", file_name);
+        _FREE(next.text);
+        return;
+    }
+
+    fprintf(stderr, "%s: %d rules, %d reused, %.1f ms\n", file_name,
+            len_pointer_list(ptr->ast->rules), ptr->reused, (get_time() - start) * 1000);
+
+    *tree = ptr;
+    _FREE(text->text);
+    *text = next;
+
+    (*callback)(ptr, ctx);
+}
+
+/*
+ * Parse the file and then parse it again every time that it changes. This
+ * only returns if the file cannot be watched.
+ */
+int watch_grammar(const char* file_name, watch_callback_t callback, void* ctx) {
+
+    char* dir = _COPY_STRING(file_name);
+    char* base = strrchr(dir, '/');
+    const char* name = file_name;
+
+    if(base != NULL) {
+        *base = '\0';
+        name = base + 1;
+    }
+
+    int fd = inotify_init();
+    if(fd < 0 || inotify_add_watch(fd, (base != NULL) ? dir : ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        misc_error("cannot watch %s: %s", file_name, strerror(errno));
+        _FREE(dir);
+        return 1;
+    }
+
+    parse_tree_t* tree = NULL;
+    watch_text_t text = { NULL, 0 };
+    update_tree(file_name, &tree, &text, callback, ctx);
+
+    // the buffer has to be aligned for the events in it
+    _Alignas(struct inotify_event) char buf[4096];
+
+    while(true) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if(len < 0) {
+            if(errno == EINTR)
+                continue;
+            misc_error("cannot watch %s: %s", file_name, strerror(errno));
+            break;
+        }
+
+        bool changed = false;
+        for(char* ptr = buf; ptr < buf + len;) {
+            struct inotify_event* ev = (struct inotify_event*)ptr;
+#ifdef TRACE_WATCH
+            fprintf(stderr, "WATCH: %s: 0x%x\n", ev->len ? ev->name : "", ev->mask);
+#endif
+            if(ev->len > 0 && !strcmp(ev->name, name))
+                changed = true;
+            ptr += sizeof(struct inotify_event) + ev->len;
+        }
+
+        if(changed)
+            update_tree(file_name, &tree, &text, callback, ctx);
+    }
+
+    destroy_parse_tree(tree);
+    _FREE(text.text);
+    close(fd);
+    _FREE(dir);
+
+    return 1;
+}
@@ -0,0 +1,13 @@
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include "parser.h"
+
+/*
+ * Called with the tree every time that the file was parsed without errors.
+ */
+typedef void (*watch_callback_t)(parse_tree_t* tree, void* ctx);
+
+int watch_grammar(const char* file_name, watch_callback_t callback, void* ctx);
+
+#endif /* _WATCH_H_ */